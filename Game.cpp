@@ -1,4 +1,7 @@
-// main.cpp
+// Game.cpp
+#ifndef _WIN32
+#define GL_GLEXT_PROTOTYPES   // framebuffer objects for --dirty-rects
+#endif
 #include <GL/glut.h>
 #include <vector>
 #include <cstdlib>
@@ -8,6 +11,36 @@
 #include <cmath>
 #include <iostream>
 #include <deque>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <coroutine>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
 
 // ─────────────────────── Window ───────────────────────
 const int windowWidth = 800;
@@ -18,15 +51,428 @@ const int POWERUP_CHANCE = 15;  // 1 in 15 chance for enemy to drop powerup
 const int MAX_LEVEL = 10;
 const float BULLET_SPEED = 12.0f;
 const float ROCKET_SPEED = 7.0f;
+const float ROCKET_TURN = 0.08f;          // homing turn per tick, radians
+const float ROCKET_LIFETIME = 3.0f;       // seconds before an unspent rocket fizzles
+const float ROCKET_BLAST_MARGIN = 10.0f;   // the blast box reaches this far past the rocket
 const float ENEMY_BASE_SPEED = 2.0f;
+const int BOSS_TYPE = 3;             // enemy type of scripted bosses
+const int BOSS_LEVEL_INTERVAL = 3;   // a boss opens every third level
+const int ROCKET_BOSS_DAMAGE = 5;    // rockets chip bosses instead of one-shotting them
+
+// ───────────────────── Level Tables ─────────────────────
+// Per-level tuning is compiled once into a LevelTable: kills to advance,
+// spawn cadence, enemy speeds with the level factor folded in, and an
+// alias table over enemy types, so a spawn costs one roll. The built-in
+// table is built at compile time. A designer file (--levels) goes through
+// the same compileLevels() at startup and yields the same layout.
+const int ENEMY_TYPES = 3;   // basic, advanced, elite; bosses are scripted
+
+// Designer-facing row, and the columns of a --levels file.
+struct LevelRow {
+    int kills;                  // defeats needed to leave the level
+    int spawnMs;                // spawner cadence
+    float speed;                // enemy speed factor
+    int weight[ENEMY_TYPES];    // relative odds of each enemy type
+};
+
+struct LevelSpec {
+    int kills;
+    float spawnSeconds;
+    float enemySpeed[ENEMY_TYPES];         // px per tick
+    int typeTotal;                         // weight sum; each alias column spans this
+    int typeCut[ENEMY_TYPES];              // a roll below the cut keeps the column's type
+    unsigned char typeAlias[ENEMY_TYPES];  // ...otherwise it becomes this type
+};
+
+struct LevelTable {
+    LevelSpec level[MAX_LEVEL + 1];   // indexed by level, [0] unused
+};
+
+constexpr LevelRow defaultLevelRow(int level) {
+    int elite = level >= 5 ? 10 + level * 2 : 0;
+    int advanced = level >= 3 ? 20 + level * 5 - elite : 0;
+    LevelRow r = {
+        level == 1 ? 10 : 10 + 5 * level,
+        std::max(300, 1500 - level * 100),
+        1.0f + level * 0.1f,
+        { 100 - advanced - elite, advanced, elite }
+    };
+    return r;
+}
+
+// Vose's alias method in integers, so the odds are exact.
+constexpr LevelSpec compileLevel(const LevelRow& r) {
+    LevelSpec s = {};
+    s.kills = r.kills;
+    s.spawnSeconds = r.spawnMs * 0.001f;
+    for (int t = 0; t < ENEMY_TYPES; t++) {
+        s.enemySpeed[t] = ENEMY_BASE_SPEED * (1.0f + t * 0.2f) * r.speed;
+    }
+
+    int total = 0;
+    for (int t = 0; t < ENEMY_TYPES; t++) total += r.weight[t];
+    s.typeTotal = total;
+    int scaled[ENEMY_TYPES] = {};
+    int small[ENEMY_TYPES] = {};
+    int large[ENEMY_TYPES] = {};
+    int smalls = 0, larges = 0;
+    for (int t = 0; t < ENEMY_TYPES; t++) {
+        scaled[t] = r.weight[t] * ENEMY_TYPES;
+        if (scaled[t] < total) small[smalls++] = t;
+        else large[larges++] = t;
+    }
+    while (smalls > 0 && larges > 0) {
+        int l = small[--smalls];
+        int g = large[--larges];
+        s.typeCut[l] = scaled[l];
+        s.typeAlias[l] = (unsigned char)g;
+        scaled[g] -= total - scaled[l];
+        if (scaled[g] < total) small[smalls++] = g;
+        else large[larges++] = g;
+    }
+    while (larges > 0) {
+        int g = large[--larges];
+        s.typeCut[g] = total;
+        s.typeAlias[g] = (unsigned char)g;
+    }
+    return s;
+}
+
+constexpr LevelTable compileLevels(const LevelRow (&rows)[MAX_LEVEL + 1]) {
+    LevelTable table = {};
+    for (int l = 1; l <= MAX_LEVEL; l++) table.level[l] = compileLevel(rows[l]);
+    return table;
+}
+
+constexpr LevelTable defaultLevels() {
+    LevelRow rows[MAX_LEVEL + 1] = {};
+    for (int l = 1; l <= MAX_LEVEL; l++) rows[l] = defaultLevelRow(l);
+    return compileLevels(rows);
+}
+
+constexpr LevelTable DEFAULT_LEVELS = defaultLevels();
+static_assert(DEFAULT_LEVELS.level[1].kills == 10 && DEFAULT_LEVELS.level[2].kills == 20,
+    "level 1 needs 10 kills, later levels 10 + 5 * level");
+static_assert(DEFAULT_LEVELS.level[1].typeCut[0] == 100 && DEFAULT_LEVELS.level[1].typeAlias[0] == 0,
+    "level 1 spawns only basic enemies");
+
+LevelTable loadedLevels;                    // --levels override
+const LevelTable* levels = &DEFAULT_LEVELS;
+
+const LevelSpec& levelSpec(int level) {
+    return levels->level[std::min(std::max(level, 1), MAX_LEVEL)];
+}
+
+// Replaces the built-in table with a designer file: one line per level,
+// `level kills spawn_ms speed basic advanced elite`, '#' starts a comment.
+// Levels the file leaves out keep their defaults.
+bool loadLevelFile(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    LevelRow rows[MAX_LEVEL + 1] = {};
+    for (int l = 1; l <= MAX_LEVEL; l++) rows[l] = defaultLevelRow(l);
+
+    char line[256];
+    int lineNo = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        lineNo++;
+        if (char* hash = strchr(line, '#')) *hash = '\0';
+        int level = 0;
+        LevelRow r = {};
+        int n = sscanf(line, "%d %d %d %f %d %d %d", &level, &r.kills, &r.spawnMs, &r.speed,
+            &r.weight[0], &r.weight[1], &r.weight[2]);
+        if (n <= 0) continue;   // blank or comment
+        ok = n == 7 && level >= 1 && level <= MAX_LEVEL && r.kills > 0 && r.spawnMs > 0 &&
+            r.speed > 0 && r.weight[0] >= 0 && r.weight[1] >= 0 && r.weight[2] >= 0 &&
+            r.weight[0] + r.weight[1] + r.weight[2] > 0;
+        if (ok) rows[level] = r;
+        else fprintf(stderr, "%s:%d: expected `level kills spawn_ms speed basic advanced elite`\n",
+            path, lineNo);
+    }
+    fclose(f);
+    if (!ok) return false;
+    loadedLevels = compileLevels(rows);
+    levels = &loadedLevels;
+    return true;
+}
+
+// The built-in rows in --levels format, as a starting point for designers.
+void printLevelRows() {
+    printf("# level kills spawn_ms speed basic advanced elite\n");
+    for (int l = 1; l <= MAX_LEVEL; l++) {
+        LevelRow r = defaultLevelRow(l);
+        printf("%d %d %d %.2f %d %d %d\n", l, r.kills, r.spawnMs, r.speed,
+            r.weight[0], r.weight[1], r.weight[2]);
+    }
+}
+
+// ─────────────────────── Tracing ───────────────────────
+// Build with -DSHOOTER_TRACE to record scoped spans; without it every
+// TRACE_* macro expands to nothing. Each thread appends to its own ring,
+// so recording never locks, and writeTrace() dumps the rings as Chrome
+// Trace Event JSON (open in Perfetto or about:tracing).
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+
+#ifdef SHOOTER_TRACE
+const int TRACE_EVENTS = 1 << 16;   // per thread; the oldest spans are overwritten
+
+struct TraceEvent {
+    const char* name;   // string literal, never freed
+    long long startNs;
+    long long durNs;
+};
+
+struct TraceBuffer {
+    TraceEvent events[TRACE_EVENTS];
+    std::atomic<unsigned long long> head;   // spans ever written
+    int tid;
+    const char* threadName;
+    TraceBuffer() : head(0), tid(0), threadName(nullptr) {}
+};
+
+std::mutex traceRegistryLock;   // taken once per thread and by writeTrace
+std::vector<TraceBuffer*> traceBuffers;   // kept past thread exit so late flushes see them
+const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+long long traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+TraceBuffer& traceBuffer() {
+    thread_local TraceBuffer* buffer = nullptr;
+    if (!buffer) {
+        buffer = new TraceBuffer();
+        std::lock_guard<std::mutex> lock(traceRegistryLock);
+        buffer->tid = int(traceBuffers.size()) + 1;
+        traceBuffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+struct TraceScope {
+    const char* name;
+    long long start;   // -1 once the span has been recorded
+    explicit TraceScope(const char* n) : name(n), start(traceNow()) {}
+    ~TraceScope() { end(); }
+    void end() {
+        if (start < 0) return;
+        TraceBuffer& b = traceBuffer();
+        unsigned long long h = b.head.load(std::memory_order_relaxed);
+        TraceEvent& e = b.events[h % TRACE_EVENTS];
+        e.name = name;
+        e.startNs = start;
+        e.durNs = traceNow() - start;
+        b.head.store(h + 1, std::memory_order_release);
+        start = -1;
+    }
+};
+
+// Writes every thread's ring. Spans a live thread overwrites while they
+// are being copied are dropped rather than emitted torn.
+bool writeTrace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    std::vector<TraceEvent> copy;
+    std::lock_guard<std::mutex> lock(traceRegistryLock);
+    for (TraceBuffer* b : traceBuffers) {
+        unsigned long long end = b->head.load(std::memory_order_acquire);
+        unsigned long long begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+        copy.clear();
+        for (unsigned long long i = begin; i < end; i++) copy.push_back(b->events[i % TRACE_EVENTS]);
+        // +1 covers the span the owner may be writing right now
+        unsigned long long now = b->head.load(std::memory_order_acquire) + 1;
+        unsigned long long valid = now > TRACE_EVENTS ? now - TRACE_EVENTS : 0;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", b->tid,
+            b->threadName ? b->threadName : "thread");
+        first = false;
+        for (unsigned long long i = std::max(begin, valid); i < end; i++) {
+            const TraceEvent& e = copy[i - begin];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}", e.name, b->tid,
+                e.startNs / 1000.0, e.durNs / 1000.0);
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(f) == 0;
+}
+
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+#define TRACE_SPAN(var, name) TraceScope var(name)
+#define TRACE_SPAN_END(var) var.end()
+#define TRACE_THREAD(name) (traceBuffer().threadName = (name))
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SPAN(var, name) ((void)0)
+#define TRACE_SPAN_END(var) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+inline bool writeTrace(const char*) { return false; }
+#endif
+
+const char* tracePath = "trace.json";   // --trace FILE, also where the T key writes
+
+void flushTrace() {
+    if (writeTrace(tracePath)) printf("Trace written to %s\n", tracePath);
+}
+
+// ───────────────── Allocation Tracking ─────────────────
+// The global operator new counts every heap allocation per thread, tagged
+// with the subsystem that made it (ALLOC_SCOPE). Drivers close a frame with
+// endAllocFrame(), and --alloc-report prints the totals at exit. With
+// --alloc-guard N, any allocation inside stepWorld once the world is N
+// ticks old aborts with the offending tag and a backtrace.
+enum AllocTag {
+    ALLOC_OTHER, ALLOC_SIM, ALLOC_SPAWN, ALLOC_EFFECTS, ALLOC_SCRIPTS,
+    ALLOC_MESSAGES, ALLOC_RENDER, ALLOC_HUD, ALLOC_NET, ALLOC_STREAM, ALLOC_AUDIO, ALLOC_TAG_COUNT
+};
+
+const char* const ALLOC_TAG_NAMES[ALLOC_TAG_COUNT] = {
+    "other", "simulation", "spawning", "effects", "scripts",
+    "messages", "render", "hud", "netplay", "stream", "audio"
+};
+
+struct AllocStats {
+    long long frameCount[ALLOC_TAG_COUNT];   // open frame, since the last endAllocFrame
+    long long frameBytes[ALLOC_TAG_COUNT];
+    long long framePending;                  // open frame, every tag
+    long long count[ALLOC_TAG_COUNT];        // closed frames
+    long long bytes[ALLOC_TAG_COUNT];
+    long long peak[ALLOC_TAG_COUNT];         // most allocations in one frame
+    long long frames;
+    long long allocatingFrames;
+};
+
+// Plain thread_locals: operator new touches them, so they must not need
+// construction or destruction.
+thread_local AllocStats allocStats;
+thread_local int allocTag = ALLOC_OTHER;
+thread_local bool allocGuarded = false;
+
+unsigned int allocGuardAfter = 0;   // --alloc-guard warm-up ticks, 0 when off
+std::mutex allocMergeLock;
+AllocStats allocMerged;             // frames of threads that have merged
+
+[[noreturn]] void allocationFault(size_t size) {
+    allocGuarded = false;
+    fprintf(stderr, "alloc guard: %zu-byte allocation from %s during a steady-state tick\n",
+        size, ALLOC_TAG_NAMES[allocTag]);
+#ifdef __GLIBC__
+    void* frames[32];
+    backtrace_symbols_fd(frames, backtrace(frames, 32), 2);
+#endif
+    abort();
+}
+
+void* trackedAlloc(size_t size) {
+    AllocStats& s = allocStats;
+    s.frameCount[allocTag]++;
+    s.frameBytes[allocTag] += size;
+    s.framePending++;
+    if (allocGuarded) allocationFault(size);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return trackedAlloc(size); }
+void* operator new[](size_t size) { return trackedAlloc(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+struct AllocScope {
+    int saved;
+    explicit AllocScope(int tag) : saved(allocTag) { allocTag = tag; }
+    ~AllocScope() { allocTag = saved; }
+};
+
+#define ALLOC_SCOPE(tag) AllocScope TRACE_JOIN(allocScope, __LINE__)(tag)
+
+// Arms the guard for one step of a world past warm-up.
+struct AllocGuard {
+    bool saved;
+    explicit AllocGuard(unsigned int tick) : saved(allocGuarded) {
+        allocGuarded = allocGuardAfter > 0 && tick >= allocGuardAfter;
+    }
+    ~AllocGuard() { allocGuarded = saved; }
+};
+
+// Closes the calling thread's frame, folding its counts into the totals.
+void endAllocFrame() {
+    AllocStats& s = allocStats;
+    s.frames++;
+    if (s.framePending == 0) return;
+    s.allocatingFrames++;
+    for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+        s.count[t] += s.frameCount[t];
+        s.bytes[t] += s.frameBytes[t];
+        s.peak[t] = std::max(s.peak[t], s.frameCount[t]);
+        s.frameCount[t] = 0;
+        s.frameBytes[t] = 0;
+    }
+    s.framePending = 0;
+}
+
+// Forgets the open frame, e.g. setup work before a loop's first frame.
+void discardAllocFrame() {
+    AllocStats& s = allocStats;
+    for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+        s.frameCount[t] = 0;
+        s.frameBytes[t] = 0;
+    }
+    s.framePending = 0;
+}
+
+// Moves the calling thread's closed frames into allocMerged.
+void mergeAllocStats() {
+    AllocStats& s = allocStats;
+    std::lock_guard<std::mutex> lock(allocMergeLock);
+    for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+        allocMerged.count[t] += s.count[t];
+        allocMerged.bytes[t] += s.bytes[t];
+        allocMerged.peak[t] = std::max(allocMerged.peak[t], s.peak[t]);
+        s.count[t] = 0;
+        s.bytes[t] = 0;
+        s.peak[t] = 0;
+    }
+    allocMerged.frames += s.frames;
+    allocMerged.allocatingFrames += s.allocatingFrames;
+    s.frames = 0;
+    s.allocatingFrames = 0;
+}
+
+// atexit hook for --alloc-report; worker threads have merged by then.
+void printAllocReport() {
+    mergeAllocStats();
+    const AllocStats& m = allocMerged;
+    printf("Allocations: %lld frames, %lld allocated (%.2f%%)\n", m.frames, m.allocatingFrames,
+        m.frames ? 100.0 * m.allocatingFrames / m.frames : 0.0);
+    printf("  %-12s %12s %14s %12s %10s\n", "subsystem", "allocs", "bytes", "per frame", "peak");
+    for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+        if (m.count[t] == 0) continue;
+        printf("  %-12s %12lld %14lld %12.3f %10lld\n", ALLOC_TAG_NAMES[t], m.count[t],
+            m.bytes[t], m.frames ? double(m.count[t]) / m.frames : 0.0, m.peak[t]);
+    }
+}
 
 // ───────────────── GameObject Types ─────────────────────
 enum PowerUpType { MULTI_SHOT, SHIELD, SPEED_BOOST, NONE };
 
 struct GameObject {
     float x, y, width, height;
+    unsigned int id;   // stable per-world identity, 0 for transient objects
     GameObject(float _x, float _y, float _w, float _h)
-        : x(_x), y(_y), width(_w), height(_h) {
+        : x(_x), y(_y), width(_w), height(_h), id(0) {
     }
     virtual ~GameObject() {}
 };
@@ -40,11 +486,18 @@ struct Bullet : GameObject {
 
 struct Enemy : GameObject {
     int health;
+    int maxHealth;
     int type;
-    float speedMultiplier;
+    float vx;        // boss sweep velocity
+    int phase;       // boss phase, set by its script
+    bool watched;    // a wave script waits on this enemy's health
+    int fireCooldown;   // ticks until the next volley
+    float shotAngle;    // rotation carried between radial/spiral volleys
     Enemy(float x, float y, int _type = 0)
-        : GameObject(x, y, 40, 20), health(1 + _type), type(_type),
-        speedMultiplier(1.0f + _type * 0.2f) {
+        : GameObject(x, y, _type == BOSS_TYPE ? 120 : 40, _type == BOSS_TYPE ? 40 : 20),
+        health(1 + _type), maxHealth(1 + _type), type(_type),
+        vx(0.0f), phase(0), watched(false),
+        fireCooldown(90), shotAngle(0.0f) {
     }
 };
 
@@ -60,23 +513,24 @@ struct Explosion {
 struct PowerUp : GameObject {
     PowerUpType type;
     float spawnTime;
-    PowerUp(float x, float y, PowerUpType _type)
-        : GameObject(x, y, 20, 20), type(_type),
-        spawnTime(glutGet(GLUT_ELAPSED_TIME) * 0.001f) {
+    PowerUp(float x, float y, PowerUpType _type, float t)
+        : GameObject(x, y, 20, 20), type(_type), spawnTime(t) {
     }
 };
 
 struct Rocket : GameObject {
     float spawnTime;
+    float vx, vy;   // homing turns the velocity; its length stays ROCKET_SPEED
     Rocket(float x, float y, float t)
-        : GameObject(x, y, 12, 30), spawnTime(t) {
+        : GameObject(x, y, 12, 30), spawnTime(t), vx(0.0f), vy(ROCKET_SPEED) {
     }
 };
 
 struct Star {
     float x, y, baseBright, size;
+    int twinkle;   // twinkle step last drawn, -1 before the first frame
     Star(float _x, float _y, float b, float s = 2.0f)
-        : x(_x), y(_y), baseBright(b), size(s) {
+        : x(_x), y(_y), baseBright(b), size(s), twinkle(-1) {
     }
 };
 
@@ -90,55 +544,790 @@ struct Particle {
     }
 };
 
-// ──────────────────── Game State Globals ────────────────────
-GameObject player(windowWidth / 2 - 25, 50, 50, 20);
-std::vector<Bullet> bullets;
-std::vector<Enemy> enemies;
-std::vector<Rocket> rockets;
+// ──────────────────── Game World ────────────────────
+// Everything the simulation touches lives in a World so that several games
+// can run side by side (batch runs, one world per worker thread). The GLUT
+// front end owns a single instance, `world`, below.
+const float TICK_SECONDS = 0.016f;
+
+// ───────────────────── Timer Wheel ─────────────────────
+// Hierarchical timing wheel counted in simulation ticks: three levels of 64
+// slots cover about 70 minutes. Scheduling, cancelling and firing are all
+// O(1); a timer only drops to a finer level when its block comes around.
+// Nodes live in a fixed array linked by index, so a World (and every
+// rollback snapshot of it) copies as plain data.
+const int WHEEL_BITS = 6;
+const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+const int WHEEL_LEVELS = 3;
+const unsigned int WHEEL_SPAN = 1u << (WHEEL_BITS * WHEEL_LEVELS);
+const int MAX_TIMERS = 32;
+
+enum TimerEvent {
+    TIMER_SPAWN,          // next enemy from the spawner
+    TIMER_INVULNERABLE    // end of post-hit invulnerability
+};
+
+struct TimerNode {
+    unsigned int due;         // tick the timer fires on
+    short next, prev;         // slot list links (next doubles as the free list)
+    short slot;               // level * WHEEL_SLOTS + slot, -1 when free
+    unsigned char event;
+    unsigned char generation; // bumps on reuse so stale handles cancel nothing
+};
+
+struct TimerWheel {
+    unsigned int now;
+    short heads[WHEEL_LEVELS * WHEEL_SLOTS];
+    TimerNode nodes[MAX_TIMERS];
+    short freeHead;
+
+    TimerWheel() : now(0), freeHead(0) {
+        for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) heads[i] = -1;
+        for (int i = 0; i < MAX_TIMERS; i++) {
+            nodes[i].slot = -1;
+            nodes[i].generation = 0;
+            nodes[i].next = short(i + 1 < MAX_TIMERS ? i + 1 : -1);
+        }
+    }
+};
+
+void wheelLink(TimerWheel& tw, short i) {
+    TimerNode& n = tw.nodes[i];
+    unsigned int delta = n.due - tw.now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (WHEEL_BITS * (level + 1)))) level++;
+    n.slot = short(level * WHEEL_SLOTS + ((n.due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+    n.prev = -1;
+    n.next = tw.heads[n.slot];
+    if (n.next >= 0) tw.nodes[n.next].prev = i;
+    tw.heads[n.slot] = i;
+}
+
+void wheelUnlink(TimerWheel& tw, short i) {
+    TimerNode& n = tw.nodes[i];
+    if (n.prev >= 0) tw.nodes[n.prev].next = n.next;
+    else tw.heads[n.slot] = n.next;
+    if (n.next >= 0) tw.nodes[n.next].prev = n.prev;
+}
+
+// Returns a handle, or -1 if every timer is in use.
+int scheduleTimer(TimerWheel& tw, unsigned int delayTicks, TimerEvent event) {
+    short i = tw.freeHead;
+    if (i < 0) return -1;
+    tw.freeHead = tw.nodes[i].next;
+    TimerNode& n = tw.nodes[i];
+    n.due = tw.now + std::max(1u, std::min(delayTicks, WHEEL_SPAN - 1));
+    n.event = (unsigned char)event;
+    wheelLink(tw, i);
+    return i | (n.generation << 8);
+}
+
+bool timerLive(const TimerWheel& tw, int handle) {
+    if (handle < 0) return false;
+    const TimerNode& n = tw.nodes[handle & 0xff];
+    return n.slot >= 0 && n.generation == (handle >> 8);
+}
+
+void releaseTimer(TimerWheel& tw, short i) {
+    tw.nodes[i].slot = -1;
+    tw.nodes[i].generation++;
+    tw.nodes[i].next = tw.freeHead;
+    tw.freeHead = i;
+}
+
+// Cancels the timer (if still pending) and clears the caller's handle.
+void cancelTimer(TimerWheel& tw, int& handle) {
+    if (timerLive(tw, handle)) {
+        wheelUnlink(tw, short(handle & 0xff));
+        releaseTimer(tw, short(handle & 0xff));
+    }
+    handle = -1;
+}
+
+unsigned int timerTicksLeft(const TimerWheel& tw, int handle) {
+    return timerLive(tw, handle) ? tw.nodes[handle & 0xff].due - tw.now : 0;
+}
+
+// Moves one coarse slot's timers down to the levels below.
+void wheelCascade(TimerWheel& tw, int slot) {
+    short i = tw.heads[slot];
+    tw.heads[slot] = -1;
+    while (i >= 0) {
+        short next = tw.nodes[i].next;
+        wheelLink(tw, i);
+        i = next;
+    }
+}
+
+// Advances one tick and calls onFire(event) for every timer due on it.
+// Handlers may schedule or cancel other timers.
+template <typename F>
+void advanceTimerWheel(TimerWheel& tw, F&& onFire) {
+    tw.now++;
+    if ((tw.now & (WHEEL_SLOTS - 1)) == 0) {
+        if (((tw.now >> WHEEL_BITS) & (WHEEL_SLOTS - 1)) == 0) {
+            wheelCascade(tw, 2 * WHEEL_SLOTS + ((tw.now >> (2 * WHEEL_BITS)) & (WHEEL_SLOTS - 1)));
+        }
+        wheelCascade(tw, WHEEL_SLOTS + ((tw.now >> WHEEL_BITS) & (WHEEL_SLOTS - 1)));
+    }
+    int slot = tw.now & (WHEEL_SLOTS - 1);
+    short i;
+    while ((i = tw.heads[slot]) >= 0) {
+        TimerEvent event = TimerEvent(tw.nodes[i].event);
+        wheelUnlink(tw, i);
+        releaseTimer(tw, i);
+        onFire(event);
+    }
+}
+
+unsigned int secondsToTicks(float seconds) {
+    return unsigned(std::ceil(seconds / TICK_SECONDS - 0.001f));
+}
+
+// ───────────────────── Modifiers ─────────────────────
+// Timed power-up effects. Every pickup is a stack with its own expiry and
+// magnitude; the stack rule of its kind decides whether a repeat pickup
+// refreshes, extends or adds a stack. Expiries sit in a min-heap keyed by
+// tick, so a step only looks at the heap top however many effects exist.
+// Fixed arrays keep the set copyable as plain data for rollback snapshots.
+enum ModifierKind {
+    MOD_MULTI_SHOT = MULTI_SHOT,     // power-up types map 1:1 onto modifiers
+    MOD_SHIELD = SHIELD,
+    MOD_SPEED_BOOST = SPEED_BOOST,
+    MOD_KIND_COUNT
+};
+
+enum StackRule {
+    STACK_REFRESH,   // one stack; a repeat pickup restarts its duration
+    STACK_EXTEND,    // one stack; a repeat pickup adds its duration, up to maxSeconds
+    STACK_ADD        // independent stacks up to maxStacks, then the oldest is refreshed
+};
+
+struct ModifierDef {
+    const char* label;       // HUD name
+    StackRule rule;
+    float seconds;           // duration of one pickup
+    float magnitude;         // per stack
+    int maxStacks;
+    float maxSeconds;        // STACK_EXTEND cap
+    const char* onMessage;
+    const char* offMessage;
+};
+
+const ModifierDef MODIFIER_DEFS[MOD_KIND_COUNT] = {
+    // Each multi-shot stack adds another pair of angled bullets
+    { "Multi-shot", STACK_ADD, 10.0f, 1.0f, 2, 0.0f, "Multi-shot activated!", "Multi-shot deactivated" },
+    // Each shield stack absorbs one collision
+    { "Shield", STACK_ADD, 15.0f, 1.0f, 3, 0.0f, "Shield activated!", "Shield deactivated" },
+    // Magnitude is extra speed: 1.0 doubles it
+    { "Speed Boost", STACK_EXTEND, 8.0f, 1.0f, 1, 24.0f, "Speed boost activated!", "Speed boost deactivated" },
+};
+
+const int MAX_MODIFIERS = 16;
+
+struct ActiveModifier {
+    unsigned int expires;    // tick the stack ends on
+    float magnitude;
+    unsigned char kind;
+    bool live;
+};
+
+struct ModifierSet {
+    ActiveModifier slots[MAX_MODIFIERS];
+    short heap[MAX_MODIFIERS];      // live slot indices, min-heap on expires
+    short heapPos[MAX_MODIFIERS];   // slot -> heap index, for O(log n) updates
+    int heapSize;
+    int stacks[MOD_KIND_COUNT];
+    float magnitude[MOD_KIND_COUNT];
+
+    ModifierSet() : heapSize(0), stacks(), magnitude() {
+        for (int i = 0; i < MAX_MODIFIERS; i++) slots[i].live = false;
+    }
+};
+
+bool modifierBefore(const ModifierSet& m, short a, short b) {
+    if (m.slots[a].expires != m.slots[b].expires) return m.slots[a].expires < m.slots[b].expires;
+    return a < b;   // deterministic tie-break
+}
+
+void modifierHeapSwap(ModifierSet& m, int i, int j) {
+    std::swap(m.heap[i], m.heap[j]);
+    m.heapPos[m.heap[i]] = short(i);
+    m.heapPos[m.heap[j]] = short(j);
+}
+
+void modifierHeapFix(ModifierSet& m, int i) {
+    while (i > 0 && modifierBefore(m, m.heap[i], m.heap[(i - 1) / 2])) {
+        modifierHeapSwap(m, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int best = i;
+        int l = 2 * i + 1, r = l + 1;
+        if (l < m.heapSize && modifierBefore(m, m.heap[l], m.heap[best])) best = l;
+        if (r < m.heapSize && modifierBefore(m, m.heap[r], m.heap[best])) best = r;
+        if (best == i) return;
+        modifierHeapSwap(m, i, best);
+        i = best;
+    }
+}
+
+short pushModifier(ModifierSet& m, ModifierKind kind, unsigned int expires, float magnitude) {
+    for (short s = 0; s < MAX_MODIFIERS; s++) {
+        if (m.slots[s].live) continue;
+        ActiveModifier& a = m.slots[s];
+        a.expires = expires;
+        a.magnitude = magnitude;
+        a.kind = (unsigned char)kind;
+        a.live = true;
+        m.stacks[kind]++;
+        m.magnitude[kind] += magnitude;
+        m.heap[m.heapSize] = s;
+        m.heapPos[s] = short(m.heapSize);
+        m.heapSize++;
+        modifierHeapFix(m, m.heapSize - 1);
+        return s;
+    }
+    return -1;
+}
+
+void removeModifier(ModifierSet& m, short s) {
+    ActiveModifier& a = m.slots[s];
+    a.live = false;
+    m.stacks[a.kind]--;
+    m.magnitude[a.kind] -= a.magnitude;
+    if (m.stacks[a.kind] == 0) m.magnitude[a.kind] = 0.0f;   // no float residue
+    int pos = m.heapPos[s];
+    m.heapSize--;
+    if (pos != m.heapSize) {
+        modifierHeapSwap(m, pos, m.heapSize);
+        modifierHeapFix(m, pos);
+    }
+}
+
+// Stack of `kind` closest to expiring, or -1.
+short soonestModifier(const ModifierSet& m, ModifierKind kind) {
+    short best = -1;
+    for (short s = 0; s < MAX_MODIFIERS; s++) {
+        if (!m.slots[s].live || m.slots[s].kind != kind) continue;
+        if (best < 0 || modifierBefore(m, s, best)) best = s;
+    }
+    return best;
+}
+
+// ───────────────────── Spatial Grid ─────────────────────
+// Uniform grid over the playfield, rebuilt each step by counting sort from
+// one point per item. Queries visit only the cells around the query, so
+// their cost follows local density rather than the item count. A handful
+// of items isn't worth binning: below GRID_SCAN_MAX queries just visit them
+// all, in index order. Enemies keep one for rockets.
+const int GRID_CELL = 64;   // cell size in pixels
+const int GRID_COLS = (windowWidth + GRID_CELL - 1) / GRID_CELL;
+const int GRID_ROWS = (windowHeight + GRID_CELL - 1) / GRID_CELL;
+const int GRID_MAX_K = 8;   // largest k for nearest queries
+const int GRID_SCAN_MAX = 32;
+
+struct SpatialGrid {
+    std::vector<int> cellStart;   // GRID_COLS * GRID_ROWS + 1 offsets into cellItems
+    std::vector<int> cellItems;   // item indices grouped by cell
+    float reach;                  // largest item half-extent around its point
+    int items;
+    bool binned;                  // false: too few items, queries scan 0..items-1
+
+    SpatialGrid() : cellStart(GRID_COLS * GRID_ROWS + 1, 0), reach(0.0f), items(0), binned(false) {}
+};
+
+int gridColumn(float x) {
+    return std::min(std::max(int(x) / GRID_CELL, 0), GRID_COLS - 1);
+}
+
+int gridRow(float y) {
+    return std::min(std::max(int(y) / GRID_CELL, 0), GRID_ROWS - 1);
+}
+
+// Bins items 0..n-1 by point(i, x, y). Counts become running ends, and the
+// backwards scatter leaves each cellStart at its cell's first item.
+template <typename PointF>
+void buildGrid(SpatialGrid& g, int n, float reach, PointF&& point) {
+    const int cells = GRID_COLS * GRID_ROWS;
+    g.reach = reach;
+    g.items = n;
+    g.binned = n > GRID_SCAN_MAX;
+    if (!g.binned) return;
+    std::fill(g.cellStart.begin(), g.cellStart.end(), 0);
+    float x, y;
+    for (int i = 0; i < n; i++) {
+        point(i, x, y);
+        g.cellStart[gridRow(y) * GRID_COLS + gridColumn(x)]++;
+    }
+    for (int c = 1; c < cells; c++) g.cellStart[c] += g.cellStart[c - 1];
+    g.cellStart[cells] = n;
+    g.cellItems.resize(n);
+    for (int i = n - 1; i >= 0; i--) {
+        point(i, x, y);
+        g.cellItems[--g.cellStart[gridRow(y) * GRID_COLS + gridColumn(x)]] = i;
+    }
+}
+
+// Calls visit(i) for each item in the cells overlapping the box (widened
+// by the grid's reach) until it returns true. Callers do the exact test.
+template <typename F>
+void queryGrid(const SpatialGrid& g, float x0, float y0, float x1, float y1, F&& visit) {
+    if (!g.binned) {
+        for (int i = 0; i < g.items; i++) {
+            if (visit(i)) return;
+        }
+        return;
+    }
+    for (int r = gridRow(y0 - g.reach); r <= gridRow(y1 + g.reach); r++) {
+        for (int c = gridColumn(x0 - g.reach); c <= gridColumn(x1 + g.reach); c++) {
+            int cell = r * GRID_COLS + c;
+            for (int k = g.cellStart[cell]; k < g.cellStart[cell + 1]; k++) {
+                if (visit(g.cellItems[k])) return;
+            }
+        }
+    }
+}
+
+// Up to k items nearest (x, y) into out, nearest first and the lower index
+// first on a tie; returns how many. dist2(i) is the squared distance to the
+// item's binned point. Rings of cells are searched outward until no
+// unvisited item can be closer.
+template <typename DistF>
+int nearestInGrid(const SpatialGrid& g, float x, float y, int k, DistF&& dist2, int* out) {
+    float best[GRID_MAX_K];
+    int found = 0;
+    k = std::min(std::min(k, GRID_MAX_K), g.items);   // else every ring is searched
+    if (k == 0) return 0;
+    auto before = [&](float d, int i, int at) {
+        return d < best[at] || (d == best[at] && i < out[at]);
+    };
+    auto consider = [&](int i) {
+        float d = dist2(i);
+        if (found == k && !before(d, i, k - 1)) return;
+        int at = found < k ? found++ : k - 1;
+        while (at > 0 && before(d, i, at - 1)) {
+            best[at] = best[at - 1];
+            out[at] = out[at - 1];
+            at--;
+        }
+        best[at] = d;
+        out[at] = i;
+    };
+    auto scanCell = [&](int c, int r) {
+        if (c < 0 || c >= GRID_COLS || r < 0 || r >= GRID_ROWS) return;
+        int cell = r * GRID_COLS + c;
+        for (int j = g.cellStart[cell]; j < g.cellStart[cell + 1]; j++) consider(g.cellItems[j]);
+    };
+
+    if (!g.binned) {
+        for (int i = 0; i < g.items; i++) consider(i);
+        return found;
+    }
+
+    int c0 = gridColumn(x), r0 = gridRow(y);
+    for (int ring = 0; ring < std::max(GRID_COLS, GRID_ROWS); ring++) {
+        // Items in this ring are at least ring - 1 cells away; one exactly
+        // that far could still win a tie
+        float bound = (ring - 1) * float(GRID_CELL);
+        if (found == k && bound > 0 && bound * bound > best[k - 1]) break;
+        if (ring == 0) {
+            scanCell(c0, r0);
+            continue;
+        }
+        for (int c = c0 - ring; c <= c0 + ring; c++) {
+            scanCell(c, r0 - ring);
+            scanCell(c, r0 + ring);
+        }
+        for (int r = r0 - ring + 1; r <= r0 + ring - 1; r++) {
+            scanCell(c0 - ring, r);
+            scanCell(c0 + ring, r);
+        }
+    }
+    return found;
+}
+
+// ───────────────────── Enemy Shots ─────────────────────
+// Enemy projectiles, sized for bullet-hell densities. Positions and
+// velocities live in parallel arrays (SoA), so integration moves four shots
+// per SSE instruction, and hit tests scan them four at a time the same way.
+const float SHOT_RADIUS = 3.0f;
+const float SHOT_PARKED = -100.0f;   // y of spent shots, culled on the next update
+
+struct EnemyShots {
+    std::vector<float> x, y, vx, vy;
+
+    size_t size() const { return x.size(); }
+};
+
+void addShot(EnemyShots& s, float x, float y, float vx, float vy) {
+    s.x.push_back(x);
+    s.y.push_back(y);
+    s.vx.push_back(vx);
+    s.vy.push_back(vy);
+}
+
+void reserveShots(EnemyShots& s, size_t n) {
+    s.x.reserve(n);
+    s.y.reserve(n);
+    s.vx.reserve(n);
+    s.vy.reserve(n);
+}
+
+// Keeps capacity, so a restarted game doesn't reallocate.
+void clearShots(EnemyShots& s) {
+    s.x.clear();
+    s.y.clear();
+    s.vx.clear();
+    s.vy.clear();
+}
+
+// `count` shots evenly spaced around a circle, starting at `angle` (radians,
+// 0 pointing right).
+void emitRadial(EnemyShots& s, float x, float y, int count, float speed, float angle) {
+    for (int i = 0; i < count; i++) {
+        float a = angle + 6.2831853f * i / count;
+        addShot(s, x, y, std::cos(a) * speed, std::sin(a) * speed);
+    }
+}
+
+// One volley of a rotating spiral; `angle` carries the rotation between volleys.
+void emitSpiral(EnemyShots& s, float x, float y, int arms, float speed, float& angle, float turn) {
+    emitRadial(s, x, y, arms, speed, angle);
+    angle += turn;
+}
+
+// `count` shots fanned `spread` radians apart, centred on (tx, ty).
+void emitAimed(EnemyShots& s, float x, float y, float tx, float ty,
+    int count, float spread, float speed) {
+    float base = std::atan2(ty - y, tx - x);
+    for (int i = 0; i < count; i++) {
+        float a = base + (i - (count - 1) * 0.5f) * spread;
+        addShot(s, x, y, std::cos(a) * speed, std::sin(a) * speed);
+    }
+}
+
+void parkShot(EnemyShots& s, int i) {
+    s.y[i] = SHOT_PARKED;
+    s.vx[i] = 0.0f;
+    s.vy[i] = 0.0f;
+}
+
+// Moves every shot one step, then drops the ones that left the playfield.
+void updateShots(EnemyShots& s) {
+    size_t n = s.size();
+    float* x = s.x.data();
+    float* y = s.y.data();
+    float* vx = s.vx.data();
+    float* vy = s.vy.data();
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(vx + i)));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(vy + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] += vx[i];
+        y[i] += vy[i];
+    }
+
+    // Compact in place; order is kept so draws don't reshuffle
+    size_t kept = 0;
+    for (i = 0; i < n; i++) {
+        if (x[i] < -SHOT_RADIUS || x[i] > windowWidth + SHOT_RADIUS ||
+            y[i] < -SHOT_RADIUS || y[i] > windowHeight + SHOT_RADIUS) continue;
+        x[kept] = x[i];
+        y[kept] = y[i];
+        vx[kept] = vx[i];
+        vy[kept] = vy[i];
+        kept++;
+    }
+    s.x.resize(kept);
+    s.y.resize(kept);
+    s.vx.resize(kept);
+    s.vy.resize(kept);
+}
+
+// Oldest shot touching the rectangle, or -1.
+int findShotHit(const EnemyShots& s, const GameObject& box) {
+    const float x0 = box.x, x1 = box.x + box.width;
+    const float y0 = box.y, y1 = box.y + box.height;
+    const float r2 = SHOT_RADIUS * SHOT_RADIUS;
+    size_t n = s.size();
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 bx0 = _mm_set1_ps(x0), bx1 = _mm_set1_ps(x1);
+    const __m128 by0 = _mm_set1_ps(y0), by1 = _mm_set1_ps(y1);
+    const __m128 br2 = _mm_set1_ps(r2);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(s.x.data() + i);
+        __m128 y = _mm_loadu_ps(s.y.data() + i);
+        __m128 dx = _mm_sub_ps(x, _mm_max_ps(bx0, _mm_min_ps(x, bx1)));
+        __m128 dy = _mm_sub_ps(y, _mm_max_ps(by0, _mm_min_ps(y, by1)));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        int hits = _mm_movemask_ps(_mm_cmple_ps(d2, br2));
+        if (hits) return int(i) + __builtin_ctz(hits);
+    }
+#endif
+    for (; i < n; i++) {
+        float dx = s.x[i] - std::max(x0, std::min(s.x[i], x1));
+        float dy = s.y[i] - std::max(y0, std::min(s.y[i], y1));
+        if (dx * dx + dy * dy <= r2) return int(i);
+    }
+    return -1;
+}
+
+// Quads (x,y pairs, four corners each) of half-size `r` around every shot,
+// for one vertex-array draw.
+void buildShotQuads(const EnemyShots& s, float r, std::vector<float>& verts) {
+    verts.resize(s.size() * 8);
+    float* v = verts.data();
+    for (size_t i = 0; i < s.size(); i++, v += 8) {
+        float x = s.x[i], y = s.y[i];
+        v[0] = x - r; v[1] = y - r;
+        v[2] = x + r; v[3] = y - r;
+        v[4] = x + r; v[5] = y + r;
+        v[6] = x - r; v[7] = y + r;
+    }
+}
+
+struct PlayerInput {
+    bool left, right, up, down;
+    PlayerInput() : left(false), right(false), up(false), down(false) {}
+};
+
+// Compact per-ship input used by the bot, the session server and the
+// rollback netcode: held directions plus one-shot actions.
+const unsigned char INPUT_LEFT = 1;
+const unsigned char INPUT_RIGHT = 2;
+const unsigned char INPUT_UP = 4;
+const unsigned char INPUT_DOWN = 8;
+const unsigned char INPUT_FIRE = 16;     // one-shot
+const unsigned char INPUT_ROCKET = 32;   // one-shot
+const unsigned char INPUT_RESTART = 64;  // one-shot
+const unsigned char INPUT_HELD = INPUT_LEFT | INPUT_RIGHT | INPUT_UP | INPUT_DOWN;
+
+struct ScriptDirector;
+
+const int MESSAGE_LINES = 4;
+const int MESSAGE_CHARS = 64;
+
+// Newest first, in fixed storage so posting a message never allocates.
+struct MessageLog {
+    char lines[MESSAGE_LINES][MESSAGE_CHARS];
+    int count;
+    MessageLog() : count(0) {}
+};
+
+// Sounds raised by the simulation, at the x they happened for panning. The
+// front end drains them into the mixer after each update; worlds nobody
+// listens to just fill up and drop the rest.
+enum SoundId { SOUND_SHOT, SOUND_ROCKET, SOUND_EXPLOSION, SOUND_HIT, SOUND_POWERUP, SOUND_COUNT };
+
+const int SOUND_CUES = 16;
+
+struct SoundCue {
+    SoundId sound;
+    float x;
+};
+
+struct SoundQueue {
+    SoundCue cues[SOUND_CUES];
+    int count;
+    SoundQueue() : count(0) {}
+};
+
+struct World {
+    GameObject player;
+    GameObject player2;   // co-op wingman, only simulated when players == 2
+    int players;
+    std::vector<Bullet> bullets;
+    std::vector<Enemy> enemies;
+    SpatialGrid enemyGrid;   // enemy centres, rebuilt only while rockets are in flight
+    std::vector<Rocket> rockets;
+    std::vector<Explosion> explosions;
+    std::vector<PowerUp> powerUps;
+    std::vector<Particle> particles;
+    EnemyShots shots;
+    MessageLog messageLog;
+    SoundQueue sounds;
+
+    int score;
+    int level;
+    int lives;
+    int enemiesDefeated;
+    int enemiesForNextLevel;
+    bool gameOver;
+    ModifierSet modifiers;   // active power-up stacks
+
+    // Sim-time timers: handles into `timers`, -1 when not pending
+    TimerWheel timers;
+    int spawnTimer;
+    int invulnerableTimer;
+    ScriptDirector* director;   // wave scripts driving spawns; null keeps the timer spawner
+
+    float simTime;        // seconds of simulated play, advances TICK_SECONDS per step
+    unsigned int tick;    // steps taken, same clock as simTime
+    unsigned int nextId;  // next entity id; 1 and 2 are the ships
+    unsigned int rngState;
+
+    World(unsigned int seed = 1)
+        : player(windowWidth / 2 - 25, 50, 50, 20),
+        player2(2 * windowWidth / 3 - 25, 50, 50, 20), players(1),
+        score(0), level(1), lives(3), enemiesDefeated(0), enemiesForNextLevel(levelSpec(1).kills),
+        gameOver(false), invulnerableTimer(-1), director(nullptr),
+        simTime(0.0f), tick(0), nextId(3), rngState(seed ? seed : 1) {
+        player.id = 1;
+        player2.id = 2;
+        spawnTimer = scheduleTimer(timers, secondsToTicks(1.0f), TIMER_SPAWN);
+    }
+};
+
+// Steady-state pool sizes. reserveWorld() sizes a world's vectors to these
+// before play so stepping never grows them. Particles and enemies are capped
+// at their pools; the rest sit well above what a game reaches.
+const int POOL_BULLETS = 256;
+const int POOL_ENEMIES = 64;
+const int POOL_ROCKETS = 32;
+const int POOL_EXPLOSIONS = 64;
+const int POOL_POWERUPS = 32;
+const int POOL_PARTICLES = 1024;
+const int POOL_SHOTS = 1024;
+
+// The entity lists of a World or a rollback snapshot.
+template <class State>
+void reservePools(State& w) {
+    w.bullets.reserve(POOL_BULLETS);
+    w.enemies.reserve(POOL_ENEMIES);
+    w.rockets.reserve(POOL_ROCKETS);
+    w.explosions.reserve(POOL_EXPLOSIONS);
+    w.powerUps.reserve(POOL_POWERUPS);
+    w.particles.reserve(POOL_PARTICLES);
+    reserveShots(w.shots, POOL_SHOTS);
+}
+
+// Not done by the constructor: server sessions stay small and grow on
+// demand instead.
+void reserveWorld(World& w) {
+    reservePools(w);
+    w.enemyGrid.cellItems.reserve(POOL_ENEMIES);
+}
+
+GameObject& shipOf(World& w, int who) {
+    return who ? w.player2 : w.player;
+}
+
+const GameObject& shipOf(const World& w, int who) {
+    return who ? w.player2 : w.player;
+}
+
+float timerSeconds(const World& w, int handle) {
+    return timerTicksLeft(w.timers, handle) * TICK_SECONDS;
+}
+
+// (Re)starts one of the world's timers, replacing any pending one.
+void restartTimer(World& w, int& handle, float seconds, TimerEvent event) {
+    cancelTimer(w.timers, handle);
+    if (seconds > 0) handle = scheduleTimer(w.timers, secondsToTicks(seconds), event);
+}
+
+int modifierStacks(const World& w, ModifierKind kind) {
+    return w.modifiers.stacks[kind];
+}
+
+// Longest time left over the kind's stacks, for the HUD.
+float modifierSeconds(const World& w, ModifierKind kind) {
+    unsigned int latest = w.tick;
+    for (const auto& a : w.modifiers.slots) {
+        if (a.live && a.kind == kind) latest = std::max(latest, a.expires);
+    }
+    return (latest - w.tick) * TICK_SECONDS;
+}
+
+float speedFactor(const World& w) {
+    return 1.0f + w.modifiers.magnitude[MOD_SPEED_BOOST];
+}
+
+// Per-world xorshift32 so worlds never contend on (or perturb) std::rand.
+int worldRand(World& w) {
+    unsigned int s = w.rngState;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    w.rngState = s;
+    return int(s >> 1);
+}
+
+// ──────────────────── Front-end Globals ────────────────────
+World world;
 std::vector<Star> stars;
-std::vector<Explosion> explosions;
-std::vector<PowerUp> powerUps;
-std::vector<Particle> particles;
-std::deque<std::string> messageLog;
-// Add with other game state globals
 
 bool specialKeys[256] = { false }; // For arrow keys
-int score = 0;
-int level = 1;
-int lives = 3;
-int enemiesDefeated = 0;
-int enemiesForNextLevel = 10;
-bool gameOver = false;
 bool keys[256] = { false };
-bool playerShield = false;
-bool multiShot = false;
-float playerSpeedBoost = 1.0f;
-float shieldTime = 0.0f;
-float multiShotTime = 0.0f;
-float speedBoostTime = 0.0f;
-float playerInvulnerableTime = 0.0f;
 bool moveRight = false;
 bool moveLeft = false;
 
+// Netplay (--peer): the rollback session steps `world` with this side's
+// input bits.
+struct RollbackSession;
+RollbackSession* netSession = nullptr;
+void rollbackFrame(RollbackSession& s, unsigned char localBits);
+
+// Recording (--record): every displayed frame is streamed to a file or pipe.
+struct StreamWriter;
+StreamWriter* recorder = nullptr;
+void recordStreamFrame(StreamWriter& s, const World& w);
+
+// Input recording (--record-inputs): each local tick's input bits, for
+// replaying the session through the differential test.
+FILE* inputLog = nullptr;
+
+// Audio (--audio): after each update the world's sound cues are posted to
+// the mixer thread.
+struct AudioMixer;
+AudioMixer* audio = nullptr;
+void queueSounds(World& w);
+
+// High scores (--scores): finished games go to a file shared by every
+// game process on the machine.
+struct ScoreStore;
+ScoreStore* scores = nullptr;
+void updateScores(ScoreStore& s, const World& w);
+void drawHighScores(const ScoreStore& s);
+
+// Damage tracking (--dirty-rects): redraw only what changed over a saved
+// copy of the last frame, then swap as usual.
+bool dirtyRects = false;
+
 // ──────────────── Function Prototypes ────────────────
 void display();
 void update(int value);
 void keyboard(unsigned char key, int x, int y);
 void keyboardUp(unsigned char key, int x, int y);
-void createEnemy();
-void enemySpawner(int value);
-void drawText(float x, float y, const std::string& txt);
-void levelUp();
-void addMessage(const std::string& msg);
-void spawnPowerUp(float x, float y);
-void createParticles(float x, float y, int count, float r, float g, float b);
+void createEnemy(World& w);
+void drawText(float x, float y, const char* txt);
+void levelUp(World& w);
+void addMessage(World& w, const char* msg);
+void pushInput(unsigned char key, bool special, bool down);
+void playSound(World& w, SoundId sound, float x);
+void spawnPowerUp(World& w, float x, float y);
+void createParticles(World& w, float x, float y, int count, float r, float g, float b);
+void stepWorld(World& w, const PlayerInput& in, const PlayerInput& in2 = PlayerInput());
+void resetWorld(World& w);
+void runScripts(ScriptDirector& d, World& w);
+void scriptEnemyHit(World& w, const Enemy& e);
+void scriptEnemyGone(World& w, const Enemy& e);
+void scriptLevelUp(World& w);
+void attachDirector(World& w, ScriptDirector& d);
+int runBatch(int games, int threads, unsigned int seed, int maxTicks);
 
 void specialKey(int key, int x, int y) {
-    specialKeys[key] = true;
+    pushInput((unsigned char)key, true, true);
 }
 
 void specialKeyUp(int key, int x, int y) {
-    specialKeys[key] = false;
+    pushInput((unsigned char)key, true, false);
 }
 // ─────────────── Rendering Helper Functions ───────────────
 void drawRect(float x, float y, float w, float h,
@@ -165,22 +1354,22 @@ void drawCircle(float x, float y, float radius,
     glEnd();
 }
 
-void drawText(float x, float y, const std::string& txt) {
+void drawText(float x, float y, const char* txt) {
     glPushMatrix();
     glColor3f(1.0f, 1.0f, 1.0f);
     glRasterPos2f(x, y);
-    for (const char c : txt) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+    for (const char* c = txt; *c; c++) {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
     }
     glPopMatrix();
 }
 
-void drawSmallText(float x, float y, const std::string& txt) {
+void drawSmallText(float x, float y, const char* txt) {
     glPushMatrix();
     glColor3f(1.0f, 1.0f, 1.0f);
     glRasterPos2f(x, y);
-    for (const char c : txt) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
+    for (const char* c = txt; *c; c++) {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
     }
     glPopMatrix();
 }
@@ -192,25 +1381,178 @@ bool isColliding(const GameObject& a, const GameObject& b) {
         a.y > b.y + b.height);
 }
 
-void drawRocket(const Rocket& r) {
-    glPushMatrix();
-    glTranslatef(r.x, r.y, 0);
-    // Body triangle
-    glColor3f(0.8f, 0.8f, 0.8f);
-    glBegin(GL_TRIANGLES);
-    glVertex2f(r.width / 2, r.height);
-    glVertex2f(0, 0);
-    glVertex2f(r.width, 0);
-    glEnd();
-    // Fins
-    drawRect(-4, 4, 4, 12, 0.7f, 0.1f, 0.1f);
-    drawRect(r.width, 4, 4, 12, 0.7f, 0.1f, 0.1f);
-    // Window
-    drawRect(r.width / 2 - 5, r.height * 0.6f, 10, 8, 0.1f, 0.1f, 0.7f);
-    // Animated flame
-    float t = (glutGet(GLUT_ELAPSED_TIME) * 0.005f) + r.spawnTime;
-    float flameLen = 8 + 4 * std::sin(t * 10);
-    glColor3f(1, 0.5f, 0);
+// ───────────────────── Sprite Cache ─────────────────────
+// Soft round effects (explosions, particles, the shield) are textured
+// quads instead of stacked 20-segment polygons. Their radial-gradient
+// textures are generated once at startup. Each quad modulates the texture
+// by its own color and alpha, and each sprite kind is sent as one
+// glDrawArrays per frame.
+const int SPRITE_SIZE = 64;        // texels per side
+const float SPRITE_PAD = 1.05f;    // quad half-size per unit of radius, room for the soft edge
+
+enum SpriteKind { SPRITE_EXPLOSION, SPRITE_GLOW, SPRITE_SHIELD, SPRITE_COUNT };
+
+GLuint spriteTextures[SPRITE_COUNT];
+
+struct SpriteBatch {
+    std::vector<float> verts;    // x, y, u, v per corner
+    std::vector<float> colors;   // r, g, b, a per corner
+};
+
+// Fades from 1 to 0 as d goes from edge0 to edge1.
+float spriteFade(float d, float edge0, float edge1) {
+    float t = std::min(std::max((d - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return 1.0f - t * t * (3.0f - 2.0f * t);
+}
+
+// Texel at distance d from the centre, in units of the effect's radius.
+void spriteTexel(SpriteKind kind, float d, float rgba[4]) {
+    rgba[0] = rgba[1] = rgba[2] = 1.0f;
+    switch (kind) {
+    case SPRITE_EXPLOSION:
+        // Flat disc with a soft rim; the quad's color tints it
+        rgba[3] = spriteFade(d, 0.9f, 1.0f);
+        break;
+    case SPRITE_GLOW: {
+        // Yellow inner fire (0.7 r, alpha 0.8) under a white core (0.3 r,
+        // alpha 0.9), composited the way the old layered circles blended
+        float core = 0.9f * spriteFade(d, 0.25f, 0.35f);
+        float fire = 0.8f * spriteFade(d, 0.62f, 0.72f);
+        rgba[3] = core + fire * (1.0f - core);
+        if (rgba[3] > 0.0f) rgba[2] = (core + 0.5f * fire * (1.0f - core)) / rgba[3];
+        break;
+    }
+    case SPRITE_SHIELD:
+        // Translucent bubble with a brighter rim
+        rgba[3] = (0.7f + 0.3f * (1.0f - spriteFade(d, 0.7f, 0.9f))) * spriteFade(d, 0.92f, 1.0f);
+        break;
+    default:
+        rgba[3] = 0.0f;
+    }
+}
+
+// Needs the GL context, so main calls it after creating the window.
+void initSprites() {
+    std::vector<unsigned char> pixels(SPRITE_SIZE * SPRITE_SIZE * 4);
+    glGenTextures(SPRITE_COUNT, spriteTextures);
+    for (int k = 0; k < SPRITE_COUNT; k++) {
+        for (int y = 0; y < SPRITE_SIZE; y++) {
+            for (int x = 0; x < SPRITE_SIZE; x++) {
+                float dx = (x + 0.5f) / SPRITE_SIZE * 2.0f - 1.0f;
+                float dy = (y + 0.5f) / SPRITE_SIZE * 2.0f - 1.0f;
+                float rgba[4];
+                spriteTexel(SpriteKind(k), std::sqrt(dx * dx + dy * dy) * SPRITE_PAD, rgba);
+                for (int c = 0; c < 4; c++) {
+                    pixels[(y * SPRITE_SIZE + x) * 4 + c] = (unsigned char)(rgba[c] * 255.0f + 0.5f);
+                }
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, spriteTextures[k]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SPRITE_SIZE, SPRITE_SIZE, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void addSprite(SpriteBatch& batch, float x, float y, float radius,
+    float r, float g, float b, float a) {
+    float h = radius * SPRITE_PAD;
+    const float corners[4][4] = {
+        { x - h, y - h, 0.0f, 0.0f }, { x + h, y - h, 1.0f, 0.0f },
+        { x + h, y + h, 1.0f, 1.0f }, { x - h, y + h, 0.0f, 1.0f },
+    };
+    for (const auto& c : corners) {
+        batch.verts.insert(batch.verts.end(), c, c + 4);
+        batch.colors.push_back(r);
+        batch.colors.push_back(g);
+        batch.colors.push_back(b);
+        batch.colors.push_back(a);
+    }
+}
+
+// Draws and empties the batch; its vectors keep their capacity.
+void drawSprites(SpriteBatch& batch, SpriteKind kind) {
+    if (batch.verts.empty()) return;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, spriteTextures[kind]);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 4 * sizeof(float), batch.verts.data());
+    glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(float), batch.verts.data() + 2);
+    glColorPointer(4, GL_FLOAT, 0, batch.colors.data());
+    glDrawArrays(GL_QUADS, 0, GLsizei(batch.verts.size() / 4));
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+    batch.verts.clear();
+    batch.colors.clear();
+}
+
+// ───────────────────────── Culling ─────────────────────────
+// Everything drawn is culled against a clip rectangle in window pixels:
+// the whole window normally, or one damaged region (see Damage Tracking).
+// The bounds cover all of a drawable's pixels, including health bars,
+// flames, the speed-boost wings and the padding around soft sprites.
+struct ClipRect {
+    float x0, y0, x1, y1;
+};
+
+const ClipRect SCREEN_RECT = { 0.0f, 0.0f, float(windowWidth), float(windowHeight) };
+
+bool overlaps(const ClipRect& a, const ClipRect& b) {
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+ClipRect aroundPoint(float x, float y, float r) {
+    return { x - r, y - r, x + r, y + r };
+}
+
+ClipRect enemyBounds(const Enemy& e) {
+    return { e.x, e.y - 8, e.x + e.width, e.y + e.height + 8 };   // turrets, health bar
+}
+
+ClipRect rocketBounds(const Rocket& r) {
+    return aroundPoint(r.x + r.width / 2, r.y + r.height / 2, 30);   // any heading, plus flame
+}
+
+ClipRect powerUpBounds(const PowerUp& p) {
+    float cx = p.x + p.width / 2, cy = p.y + p.height / 2;
+    return { cx - 15, cy - 20, cx + 15, cy + 20 };   // spins and bobs 5 px
+}
+
+ClipRect shipBounds(const GameObject& s) {
+    float cy = s.y + s.height / 2;
+    return { s.x - 15, cy - 36, s.x + s.width + 15, cy + 36 };   // wings, flames, shield
+}
+
+void drawRocket(const Rocket& r) {
+    glPushMatrix();
+    // Nose along the velocity, turning about the rocket's centre
+    glTranslatef(r.x + r.width / 2, r.y + r.height / 2, 0);
+    glRotatef(-std::atan2(r.vx, r.vy) * 57.29578f, 0, 0, 1);
+    glTranslatef(-r.width / 2, -r.height / 2, 0);
+    // Body triangle
+    glColor3f(0.8f, 0.8f, 0.8f);
+    glBegin(GL_TRIANGLES);
+    glVertex2f(r.width / 2, r.height);
+    glVertex2f(0, 0);
+    glVertex2f(r.width, 0);
+    glEnd();
+    // Fins
+    drawRect(-4, 4, 4, 12, 0.7f, 0.1f, 0.1f);
+    drawRect(r.width, 4, 4, 12, 0.7f, 0.1f, 0.1f);
+    // Window
+    drawRect(r.width / 2 - 5, r.height * 0.6f, 10, 8, 0.1f, 0.1f, 0.7f);
+    // Animated flame
+    float t = (glutGet(GLUT_ELAPSED_TIME) * 0.005f) + r.spawnTime;
+    float flameLen = 8 + 4 * std::sin(t * 10);
+    glColor3f(1, 0.5f, 0);
     glBegin(GL_TRIANGLES);
     glVertex2f(r.width / 2, 0);
     glVertex2f(r.width / 2 - 6, -flameLen);
@@ -231,6 +1573,9 @@ void drawEnemy(const Enemy& e) {
     case 2: // Elite enemy
         r = 0.2f; g = 0.2f; b = 1.0f;
         break;
+    case BOSS_TYPE:
+        r = 0.7f; g = 0.1f; b = 0.7f;
+        break;
     default:
         r = 0.8f; g = 0.8f; b = 0.0f;
     }
@@ -239,7 +1584,7 @@ void drawEnemy(const Enemy& e) {
 
     // Draw health bar
     if (e.health > 1) {
-        float healthPercentage = e.health / float(e.type + 1);
+        float healthPercentage = std::min(1.0f, e.health / float(e.maxHealth));
         drawRect(e.x, e.y + e.height + 5, e.width * healthPercentage, 3,
             0.0f, 1.0f, 0.0f);
     }
@@ -254,11 +1599,58 @@ void drawEnemy(const Enemy& e) {
         drawCircle(e.x + 10, e.y + e.height / 2, 4, 0.7f, 0.7f, 1.0f);
         drawCircle(e.x + e.width - 10, e.y + e.height / 2, 4, 0.7f, 0.7f, 1.0f);
     }
+    else if (e.type == BOSS_TYPE) {
+        // Boss core heats up with each phase, flanked by two turrets
+        drawCircle(e.x + e.width / 2, e.y + e.height / 2, 12, 1.0f, 1.0f - e.phase * 0.4f, 0.2f);
+        drawRect(e.x + 10, e.y - 8, 12, 8, 0.5f, 0.5f, 0.6f);
+        drawRect(e.x + e.width - 22, e.y - 8, 12, 8, 0.5f, 0.5f, 0.6f);
+    }
+}
+
+// Glow and core quads for every shot, built once per frame. Each clip
+// rectangle then draws just the shots that touch it through an index list.
+struct ShotBatch {
+    std::vector<float> glow, core;
+    std::vector<GLuint> indices;   // four per shot in the current clip
+};
+
+ShotBatch shotBatch;   // reused across frames
+
+void buildShotBatch(const World& w) {
+    buildShotQuads(w.shots, SHOT_RADIUS * 2, shotBatch.glow);
+    buildShotQuads(w.shots, SHOT_RADIUS, shotBatch.core);
+}
+
+// All shots in `clip` in two indexed vertex-array draws (glow, then core)
+// instead of immediate-mode quads per shot.
+void drawEnemyShots(const World& w, const ClipRect& clip) {
+    std::vector<GLuint>& indices = shotBatch.indices;
+    indices.clear();
+    for (size_t i = 0; i < w.shots.size(); i++) {
+        if (!overlaps(aroundPoint(w.shots.x[i], w.shots.y[i], SHOT_RADIUS * 2), clip)) continue;
+        GLuint v = GLuint(i * 4);
+        indices.insert(indices.end(), { v, v + 1, v + 2, v + 3 });
+    }
+    if (indices.empty()) return;
+    GLsizei count = GLsizei(indices.size());
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    glVertexPointer(2, GL_FLOAT, 0, shotBatch.glow.data());
+    glColor4f(1.0f, 0.3f, 0.6f, 0.35f);
+    glDrawElements(GL_QUADS, count, GL_UNSIGNED_INT, indices.data());
+
+    glVertexPointer(2, GL_FLOAT, 0, shotBatch.core.data());
+    glColor4f(1.0f, 0.9f, 0.95f, 1.0f);
+    glDrawElements(GL_QUADS, count, GL_UNSIGNED_INT, indices.data());
+
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
-void drawPlayer() {
-    // Base ship
-    drawRect(player.x, player.y, player.width, player.height, 0.2f, 0.7f, 1.0f);
+void drawPlayer(const World& w, int who = 0) {
+    const GameObject& player = shipOf(w, who);
+    // Base ship (the co-op wingman is painted orange)
+    if (who == 0) drawRect(player.x, player.y, player.width, player.height, 0.2f, 0.7f, 1.0f);
+    else drawRect(player.x, player.y, player.width, player.height, 1.0f, 0.6f, 0.2f);
 
     // Ship details
     drawRect(player.x + player.width / 2 - 5, player.y + player.height - 5, 10, 8, 0.1f, 0.3f, 0.8f);
@@ -283,14 +1675,16 @@ void drawPlayer() {
     glEnd();
 
     // Draw shield if active
-    if (playerShield) {
+    if (modifierStacks(w, MOD_SHIELD) > 0) {
+        static SpriteBatch shield;
         float pulseScale = 0.8f + 0.2f * std::sin(t * 5);
-        drawCircle(player.x + player.width / 2, player.y + player.height / 2,
+        addSprite(shield, player.x + player.width / 2, player.y + player.height / 2,
             player.width / 1.5f * pulseScale, 0.4f, 0.8f, 1.0f, 0.5f);
+        drawSprites(shield, SPRITE_SHIELD);
     }
 
     // Draw speed boost effect if active
-    if (playerSpeedBoost > 1.0f) {
+    if (speedFactor(w) > 1.0f) {
         glColor4f(0.0f, 1.0f, 0.5f, 0.7f);
         glBegin(GL_TRIANGLES);
         glVertex2f(player.x, player.y + player.height / 2);
@@ -306,13 +1700,14 @@ void drawPlayer() {
     }
 
     // Invulnerability blinking
-    if (playerInvulnerableTime > 0 && int(playerInvulnerableTime * 10) % 2 == 0) {
+    float invulnerable = timerSeconds(w, w.invulnerableTimer);
+    if (invulnerable > 0 && int(invulnerable * 10) % 2 == 0) {
         drawRect(player.x, player.y, player.width, player.height, 1.0f, 1.0f, 1.0f, 0.7f);
     }
 }
 
-void drawPowerUp(const PowerUp& p) {
-    float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f - p.spawnTime;
+void drawPowerUp(const World& w, const PowerUp& p) {
+    float t = w.simTime - p.spawnTime;
     float floatOffset = 5 * sin(t * 3);
     float rotation = t * 90;
 
@@ -355,188 +1750,449 @@ void drawPowerUp(const PowerUp& p) {
 }
 
 // ───────────────────── Game Logic ─────────────────────
-void fireBullet() {
-    if (multiShot) {
-        // Triple shot pattern
-        bullets.emplace_back(player.x + player.width / 2 - 2.5f,
-            player.y + player.height);
-        bullets.emplace_back(player.x + player.width / 2 - 2.5f,
-            player.y + player.height, -0.2f);
-        bullets.emplace_back(player.x + player.width / 2 - 2.5f,
-            player.y + player.height, 0.2f);
+void fireBullet(World& w, int who = 0) {
+    const GameObject& ship = shipOf(w, who);
+    size_t first = w.bullets.size();
+    w.bullets.emplace_back(ship.x + ship.width / 2 - 2.5f,
+        ship.y + ship.height);
+    // Each multi-shot stack adds a wider pair of angled bullets
+    for (int k = 1; k <= modifierStacks(w, MOD_MULTI_SHOT); k++) {
+        w.bullets.emplace_back(ship.x + ship.width / 2 - 2.5f,
+            ship.y + ship.height, -0.2f * k);
+        w.bullets.emplace_back(ship.x + ship.width / 2 - 2.5f,
+            ship.y + ship.height, 0.2f * k);
     }
-    else {
-        // Regular shot
-        bullets.emplace_back(player.x + player.width / 2 - 2.5f,
-            player.y + player.height);
+    for (size_t i = first; i < w.bullets.size(); i++) {
+        w.bullets[i].id = w.nextId++;
     }
-
-    // Sound effects and visual flair would go here in a full game
+    playSound(w, SOUND_SHOT, ship.x + ship.width / 2);
 }
 
-void fireRocket() {
-    float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
-    rockets.emplace_back(player.x + player.width / 2 - 6,
-        player.y + player.height,
-        t);
+void fireRocket(World& w, int who = 0) {
+    const GameObject& ship = shipOf(w, who);
+    w.rockets.emplace_back(ship.x + ship.width / 2 - 6,
+        ship.y + ship.height,
+        w.simTime);
+    w.rockets.back().id = w.nextId++;
+    playSound(w, SOUND_ROCKET, ship.x + ship.width / 2);
 
     // Create exhaust particles
-    createParticles(
-        player.x + player.width / 2,
-        player.y + player.height,
+    createParticles(w,
+        ship.x + ship.width / 2,
+        ship.y + ship.height,
         10,
         1.0f, 0.5f, 0.0f
     );
 }
 
-void createEnemy() {
-    float ex = std::rand() % (windowWidth - 40);
+// Enemy type determination based on level
+// One roll picks an alias column and the coin within it.
+int rollEnemyType(World& w) {
+    const LevelSpec& spec = levelSpec(w.level);
+    int roll = worldRand(w) % unsigned(ENEMY_TYPES * spec.typeTotal);
+    int column = roll / spec.typeTotal;
+    return roll % spec.typeTotal < spec.typeCut[column] ? column : spec.typeAlias[column];
+}
 
-    // Enemy type determination based on level
-    int type = 0;
-    int roll = rand() % 100;
+// Null when the enemy pool is full. Formations and escorts at high levels
+// can outrun it, so they skip spawns instead; the last slot is kept for
+// bosses.
+Enemy* spawnEnemyAt(World& w, float x, int type) {
+    ALLOC_SCOPE(ALLOC_SPAWN);
+    size_t limit = type == BOSS_TYPE ? POOL_ENEMIES : POOL_ENEMIES - 1;
+    if (w.enemies.size() >= limit) return nullptr;
+    w.enemies.emplace_back(x, windowHeight, type);
+    w.enemies.back().id = w.nextId++;
+    return &w.enemies.back();
+}
 
-    if (level >= 3 && roll < 20 + level * 5) {
-        type = 1; // Advanced enemy appears more as level increases
-    }
+void createEnemy(World& w) {
+    float ex = worldRand(w) % (windowWidth - 40);
+    spawnEnemyAt(w, ex, rollEnemyType(w));
+}
 
-    if (level >= 5 && roll < 10 + level * 2) {
-        type = 2; // Elite enemy has small chance in higher levels
+// Bosses drop to a hover line, lower in their last phase, and sweep side to side.
+void moveBoss(Enemy& e) {
+    float hover = e.phase >= 2 ? windowHeight * 0.55f : windowHeight - 100.0f;
+    if (e.y > hover) e.y = std::max(hover, e.y - ENEMY_BASE_SPEED);
+    e.x += e.vx;
+    if (e.x < 0 || e.x > windowWidth - e.width) {
+        e.vx = -e.vx;
+        e.x = std::max(0.0f, std::min(e.x, float(windowWidth - e.width)));
     }
+}
 
-    enemies.emplace_back(ex, windowHeight, type);
+void enemySpawner(World& w) {
+    TRACE_SCOPE("enemySpawner");
+    createEnemy(w);
+    // Spawn rate increases with level
+    float delay = levelSpec(w.level).spawnSeconds;
+    w.spawnTimer = scheduleTimer(w.timers, secondsToTicks(delay), TIMER_SPAWN);
 }
 
-void enemySpawner(int value) {
-    if (!gameOver) {
-        createEnemy();
-        // Spawn rate increases with level
-        int delay = std::max(300, 1500 - level * 100);
-        glutTimerFunc(delay, enemySpawner, 0);
+void onTimer(World& w, TimerEvent event) {
+    switch (event) {
+    case TIMER_SPAWN:
+        w.spawnTimer = -1;
+        enemySpawner(w);
+        break;
+
+    case TIMER_INVULNERABLE:
+        w.invulnerableTimer = -1;
+        break;
     }
 }
 
-void levelUp() {
-    level++;
+void levelUp(World& w) {
+    w.level++;
 
     // Display level up message
-    std::stringstream ss;
-    ss << "LEVEL " << level << "!";
-    addMessage(ss.str());
+    char msg[MESSAGE_CHARS];
+    snprintf(msg, sizeof(msg), "LEVEL %d!", w.level);
+    addMessage(w, msg);
 
-    if (level <= MAX_LEVEL) {
+    if (w.level <= MAX_LEVEL) {
         // Increase enemies needed for next level
-        enemiesForNextLevel = 10 + 5 * level;
-        enemiesDefeated = 0;
+        w.enemiesForNextLevel = levelSpec(w.level).kills;
+        w.enemiesDefeated = 0;
 
         // Bonus for leveling up
-        if (level % 2 == 0) {
-            lives++;
-            addMessage("Extra life awarded!");
+        if (w.level % 2 == 0) {
+            w.lives++;
+            addMessage(w, "Extra life awarded!");
         }
     }
-    else if (level == MAX_LEVEL + 1) {
-        addMessage("MAXIMUM LEVEL REACHED!");
+    else if (w.level == MAX_LEVEL + 1) {
+        addMessage(w, "MAXIMUM LEVEL REACHED!");
     }
+    scriptLevelUp(w);
+}
+
+void addMessage(World& w, const char* msg) {
+    ALLOC_SCOPE(ALLOC_MESSAGES);
+    MessageLog& log = w.messageLog;
+    memmove(log.lines[1], log.lines[0], (MESSAGE_LINES - 1) * MESSAGE_CHARS);
+    snprintf(log.lines[0], MESSAGE_CHARS, "%s", msg);
+    log.count = std::min(log.count + 1, MESSAGE_LINES);
+}
+
+void playSound(World& w, SoundId sound, float x) {
+    if (w.sounds.count == SOUND_CUES) return;
+    w.sounds.cues[w.sounds.count++] = { sound, x };
+}
+
+void spawnPowerUp(World& w, float x, float y) {
+    if (worldRand(w) % POWERUP_CHANCE != 0) return;
+
+    PowerUpType type = static_cast<PowerUpType>(worldRand(w) % 3);
+    w.powerUps.emplace_back(x, y, type, w.simTime);
+    w.powerUps.back().id = w.nextId++;
 }
 
-void addMessage(const std::string& msg) {
-    messageLog.push_front(msg);
-    if (messageLog.size() > 4) {
-        messageLog.pop_back();
+// Applies one pickup of `kind` according to its stack rule.
+void addModifier(World& w, ModifierKind kind) {
+    const ModifierDef& def = MODIFIER_DEFS[kind];
+    ModifierSet& m = w.modifiers;
+    unsigned int duration = secondsToTicks(def.seconds);
+    short s = soonestModifier(m, kind);
+
+    if (s >= 0 && (def.rule != STACK_ADD || m.stacks[kind] >= def.maxStacks)) {
+        // Reuse the stack closest to expiring
+        ActiveModifier& a = m.slots[s];
+        if (def.rule == STACK_EXTEND) {
+            a.expires = std::min(a.expires + duration, w.tick + secondsToTicks(def.maxSeconds));
+        }
+        else {
+            a.expires = w.tick + duration;
+        }
+        modifierHeapFix(m, m.heapPos[s]);
+    }
+    else {
+        pushModifier(m, kind, w.tick + duration, def.magnitude);
+    }
+
+    if (m.stacks[kind] > 1) {
+        char msg[MESSAGE_CHARS];
+        snprintf(msg, sizeof(msg), "%s x%d!", def.label, m.stacks[kind]);
+        addMessage(w, msg);
+    }
+    else {
+        addMessage(w, def.onMessage);
     }
 }
 
-void spawnPowerUp(float x, float y) {
-    if (rand() % POWERUP_CHANCE != 0) return;
+// Uses up the stack of `kind` closest to expiring; false if none is active.
+bool consumeModifier(World& w, ModifierKind kind) {
+    short s = soonestModifier(w.modifiers, kind);
+    if (s < 0) return false;
+    removeModifier(w.modifiers, s);
+    return true;
+}
 
-    PowerUpType type = static_cast<PowerUpType>(rand() % 3);
-    powerUps.emplace_back(x, y, type);
+// Ends every stack whose time is up. Only the heap top is examined when
+// nothing is due.
+void expireModifiers(World& w) {
+    ModifierSet& m = w.modifiers;
+    while (m.heapSize > 0 && m.slots[m.heap[0]].expires <= w.tick) {
+        ModifierKind kind = ModifierKind(m.slots[m.heap[0]].kind);
+        removeModifier(m, m.heap[0]);
+        if (m.stacks[kind] == 0) {
+            addMessage(w, MODIFIER_DEFS[kind].offMessage);
+        }
+    }
 }
 
-void createParticles(float x, float y, int count, float r, float g, float b) {
+void createParticles(World& w, float x, float y, int count, float r, float g, float b) {
+    TRACE_SCOPE("createParticles");
+    ALLOC_SCOPE(ALLOC_EFFECTS);
+    // Visible change: a burst that would overflow the pool is cut short, so
+    // a screen full of explosions shows fewer sparks rather than growing it.
+    count = std::min(count, POOL_PARTICLES - int(w.particles.size()));
     for (int i = 0; i < count; i++) {
-        float angle = (rand() % 628) / 100.0f;
-        float speed = 1.0f + (rand() % 200) / 100.0f;
+        float angle = (worldRand(w) % 628) / 100.0f;
+        float speed = 1.0f + (worldRand(w) % 200) / 100.0f;
         float vx = cos(angle) * speed;
         float vy = sin(angle) * speed;
-        float lifetime = 0.5f + (rand() % 100) / 100.0f;
-        float size = 1.0f + (rand() % 30) / 10.0f;
+        float lifetime = 0.5f + (worldRand(w) % 100) / 100.0f;
+        float size = 1.0f + (worldRand(w) % 30) / 10.0f;
 
-        particles.emplace_back(x, y, vx, vy, lifetime, size, r, g, b);
+        w.particles.emplace_back(x, y, vx, vy, lifetime, size, r, g, b);
     }
 }
 
-void update(int) {
-    float currentTime = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+// Purely visual state; also advanced by the replay viewer.
+void updateEffects(World& w) {
+    // — Update explosions
+    for (auto it = w.explosions.begin(); it != w.explosions.end();) {
+        it->alpha -= 0.04f;
+        it->size += 2.0f;
+        if (it->alpha <= 0) {
+            it = w.explosions.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
 
-    // Always keep updating the display
-    glutPostRedisplay();
-    glutTimerFunc(16, update, 0);
+    // — Update particles
+    for (auto it = w.particles.begin(); it != w.particles.end();) {
+        it->x += it->vx;
+        it->y += it->vy;
+        it->lifetime -= 0.016f;
+        it->alpha = it->lifetime / it->maxLife;
 
-    if (gameOver) {
-        return;
+        if (it->lifetime <= 0) {
+            it = w.particles.erase(it);
+        }
+        else {
+            ++it;
+        }
     }
+}
 
-    // Update timer-based power-ups
-    if (shieldTime > 0) {
-        shieldTime -= 0.016f;
-        if (shieldTime <= 0) {
-            playerShield = false;
-            addMessage("Shield deactivated");
-        }
+void moveShip(GameObject& ship, const PlayerInput& in, float speed) {
+    if (in.left) {
+        ship.x -= speed;
     }
+    if (in.right) {
+        ship.x += speed;
+    }
+    if (in.up) {
+        ship.y += speed;
+    }
+    if (in.down) {
+        ship.y -= speed;
+    }
+
+    // Keep player in bounds
+    ship.x = std::max(0.0f, std::min(ship.x, float(windowWidth - ship.width)));
+    ship.y = std::max(0.0f, std::min(ship.y, float(windowHeight - ship.height)));
+}
+
+void buildEnemyGrid(World& w) {
+    float reach = 0.0f;
+    for (const auto& e : w.enemies) reach = std::max(reach, std::max(e.width, e.height) / 2);
+    buildGrid(w.enemyGrid, int(w.enemies.size()), reach, [&](int i, float& x, float& y) {
+        x = w.enemies[i].x + w.enemies[i].width / 2;
+        y = w.enemies[i].y + w.enemies[i].height / 2;
+    });
+}
+
+// Calls visit(i) for each live enemy colliding with `box`, until it returns
+// true. Uses the grid from the last buildEnemyGrid.
+template <typename F>
+void enemiesInBox(const World& w, const GameObject& box, F&& visit) {
+    queryGrid(w.enemyGrid, box.x, box.y, box.x + box.width, box.y + box.height, [&](int i) {
+        const Enemy& e = w.enemies[i];
+        return e.health > 0 && isColliding(box, e) && visit(i);
+    });
+}
+
+// Up to k enemies nearest (x, y) by centre, nearest first; returns how many.
+int nearestEnemies(const World& w, float x, float y, int k, int* out) {
+    return nearestInGrid(w.enemyGrid, x, y, k, [&](int i) {
+        float dx = w.enemies[i].x + w.enemies[i].width / 2 - x;
+        float dy = w.enemies[i].y + w.enemies[i].height / 2 - y;
+        return dx * dx + dy * dy;
+    }, out);
+}
+
+// Turns a rocket toward the nearest enemy by at most ROCKET_TURN.
+void steerRocket(const World& w, Rocket& r) {
+    float cx = r.x + r.width / 2, cy = r.y + r.height / 2;
+    int nearest;
+    if (nearestEnemies(w, cx, cy, 1, &nearest) == 0) return;
+    const Enemy& e = w.enemies[nearest];
+    float heading = std::atan2(r.vy, r.vx);
+    float turn = std::atan2(e.y + e.height / 2 - cy, e.x + e.width / 2 - cx) - heading;
+    if (turn > 3.1415926f) turn -= 6.2831853f;
+    if (turn < -3.1415926f) turn += 6.2831853f;
+    heading += std::max(-ROCKET_TURN, std::min(turn, ROCKET_TURN));
+    r.vx = std::cos(heading) * ROCKET_SPEED;
+    r.vy = std::sin(heading) * ROCKET_SPEED;
+}
+
+GameObject rocketBlast(const Rocket& r) {
+    return GameObject(r.x - ROCKET_BLAST_MARGIN, r.y - ROCKET_BLAST_MARGIN,
+        r.width + 2 * ROCKET_BLAST_MARGIN, r.height + 2 * ROCKET_BLAST_MARGIN);
+}
 
-    if (multiShotTime > 0) {
-        multiShotTime -= 0.016f;
-        if (multiShotTime <= 0) {
-            multiShot = false;
-            addMessage("Multi-shot deactivated");
+// The enemy a rocket detonates on: the first in spawn order touching its
+// blast box, or -1.
+int rocketBlastTarget(const World& w, const Rocket& r) {
+    int target = -1;
+    enemiesInBox(w, rocketBlast(r), [&](int i) {
+        if (target < 0 || i < target) target = i;
+        return false;
+    });
+    return target;
+}
+
+// Volley patterns by type: basics aim single shots from level 4, advanced
+// enemies aim spreads, elites fire rotating rings, and bosses change
+// pattern with each phase. Cooldowns shorten as the level rises.
+void enemyFire(World& w, Enemy& e) {
+    if (--e.fireCooldown > 0 || e.y > windowHeight - e.height || e.y < 150) return;
+
+    const GameObject* target = &w.player;
+    if (w.players > 1 && std::fabs(w.player2.x - e.x) < std::fabs(w.player.x - e.x)) target = &w.player2;
+    float cx = e.x + e.width / 2, cy = e.y;
+    float tx = target->x + target->width / 2, ty = target->y + target->height / 2;
+    float pace = 10.0f / (9 + w.level);
+
+    switch (e.type) {
+    case 0:
+        if (w.level >= 4) emitAimed(w.shots, cx, cy, tx, ty, 1, 0.0f, 2.5f);
+        e.fireCooldown = int((240 + worldRand(w) % 120) * pace);
+        break;
+    case 1:
+        emitAimed(w.shots, cx, cy, tx, ty, 3, 0.25f, 2.5f);
+        e.fireCooldown = int((200 + worldRand(w) % 100) * pace);
+        break;
+    case 2:
+        emitSpiral(w.shots, cx, cy, 8, 2.0f, e.shotAngle, 0.3f);
+        e.fireCooldown = int((200 + worldRand(w) % 100) * pace);
+        break;
+    case BOSS_TYPE:
+        if (e.phase == 0) {
+            emitAimed(w.shots, cx, cy, tx, ty, 3, 0.3f, 2.5f);
+            e.fireCooldown = 120;
         }
+        else {
+            emitSpiral(w.shots, cx, cy, e.phase + 1, 2.5f, e.shotAngle, 0.35f);
+            if (e.phase >= 2 && w.tick % 90 == 0) emitRadial(w.shots, cx, cy, 12, 2.0f, 0.0f);
+            e.fireCooldown = 12;
+        }
+        break;
+    }
+}
+
+// Shield or life loss for a hit ship. True when it ended the game.
+bool damageShip(World& w, GameObject& ship) {
+    playSound(w, SOUND_HIT, ship.x + ship.width / 2);
+    if (consumeModifier(w, MOD_SHIELD)) {
+        // Shield absorbs the hit, one stack per collision
+        addMessage(w, "Shield absorbed a collision!");
+        restartTimer(w, w.invulnerableTimer, 1.0f, TIMER_INVULNERABLE);
+        return false;
     }
 
-    if (speedBoostTime > 0) {
-        speedBoostTime -= 0.016f;
-        if (speedBoostTime <= 0) {
-            playerSpeedBoost = 1.0f;
-            addMessage("Speed boost deactivated");
-        }
+    // Player loses a life
+    w.lives--;
+    if (w.lives <= 0) {
+        w.gameOver = true;
+
+        // Big explosion for player death
+        playSound(w, SOUND_EXPLOSION, ship.x + ship.width / 2);
+        w.explosions.emplace_back(
+            ship.x + ship.width / 2,
+            ship.y + ship.height / 2,
+            80.0f,
+            1.0f, 0.0f, 0.0f
+        );
+
+        createParticles(w,
+            ship.x + ship.width / 2,
+            ship.y + ship.height / 2,
+            40,
+            1.0f, 0.5f, 0.2f
+        );
+
+        return true;
     }
 
-    if (playerInvulnerableTime > 0) {
-        playerInvulnerableTime -= 0.016f;
+    addMessage(w, "Ship damaged! Life lost.");
+    restartTimer(w, w.invulnerableTimer, 3.0f, TIMER_INVULNERABLE);
+    return false;
+}
+
+// One fixed simulation step. Touches nothing outside `w`, so independent
+// worlds can be stepped concurrently, and is a pure function of the world
+// and inputs, so rollback can replay it.
+void stepWorld(World& w, const PlayerInput& in, const PlayerInput& in2) {
+    if (w.gameOver) {
+        return;
     }
 
+    TRACE_SCOPE("stepWorld");
+    AllocGuard guard(w.tick);
+    ALLOC_SCOPE(ALLOC_SIM);
+    w.simTime += TICK_SECONDS;
+    w.tick++;
+    float currentTime = w.simTime;
+
+    // — Fire due timers (enemy spawns, invulnerability) and expire power-ups
+    advanceTimerWheel(w.timers, [&](TimerEvent event) { onTimer(w, event); });
+    expireModifiers(w);
+
+    // — Resume wave scripts whose events have happened
+    if (w.director) runScripts(*w.director, w);
+
     // — Move bullets
-    for (auto it = bullets.begin(); it != bullets.end();) {
+    for (auto it = w.bullets.begin(); it != w.bullets.end();) {
         float vx = sin(it->angle) * BULLET_SPEED;
         float vy = cos(it->angle) * BULLET_SPEED;
         it->x += vx;
         it->y += vy;
 
         if (it->y > windowHeight || it->x < 0 || it->x > windowWidth) {
-            it = bullets.erase(it);
+            it = w.bullets.erase(it);
         }
         else {
             ++it;
         }
     }
 
-    // — Move rockets
-    for (auto it = rockets.begin(); it != rockets.end();) {
-        it->y += ROCKET_SPEED;
-        if (it->y > windowHeight) {
-            it = rockets.erase(it);
-        }
-        else {
+    // — Move enemies
+    for (auto it = w.enemies.begin(); it != w.enemies.end();) {
+        if (it->type == BOSS_TYPE) {
+            moveBoss(*it);
+            enemyFire(w, *it);
             ++it;
+            continue;
         }
-    }
 
-    // — Move enemies
-    for (auto it = enemies.begin(); it != enemies.end();) {
-        float speed = ENEMY_BASE_SPEED * it->speedMultiplier * (1.0f + level * 0.1f);
-        it->y -= speed;
+        it->y -= levelSpec(w.level).enemySpeed[it->type];
 
         // Advanced enemies move in patterns
         if (it->type == 1) {
@@ -548,76 +2204,76 @@ void update(int) {
 
         // Keep enemies within screen bounds
         it->x = std::max(0.0f, std::min(it->x, float(windowWidth - it->width)));
+        enemyFire(w, *it);
 
         if (it->y < 0) {
-            it = enemies.erase(it);
-            if (--lives <= 0) {
-                gameOver = true;
+            scriptEnemyGone(w, *it);
+            it = w.enemies.erase(it);
+            if (--w.lives <= 0) {
+                w.gameOver = true;
                 return;
             }
-            addMessage("Enemy reached the base! Life lost.");
+            addMessage(w, "Enemy reached the base! Life lost.");
         }
         else {
             ++it;
         }
     }
 
-    // — Move power-ups
-    for (auto it = powerUps.begin(); it != powerUps.end();) {
-        it->y -= 1.0f;
-        if (it->y < 0) {
-            it = powerUps.erase(it);
+    // — Index enemies, then steer and move rockets
+    if (!w.rockets.empty()) buildEnemyGrid(w);
+    for (auto it = w.rockets.begin(); it != w.rockets.end();) {
+        steerRocket(w, *it);
+        it->x += it->vx;
+        it->y += it->vy;
+        if (it->y > windowHeight || it->y < -it->height || it->x < -it->width ||
+            it->x > windowWidth || w.simTime - it->spawnTime > ROCKET_LIFETIME) {
+            it = w.rockets.erase(it);
         }
         else {
             ++it;
         }
     }
 
-    // — Update explosions
-    for (auto it = explosions.begin(); it != explosions.end();) {
-        it->alpha -= 0.04f;
-        it->size += 2.0f;
-        if (it->alpha <= 0) {
-            it = explosions.erase(it);
+    // — Move power-ups
+    for (auto it = w.powerUps.begin(); it != w.powerUps.end();) {
+        it->y -= 1.0f;
+        if (it->y < 0) {
+            it = w.powerUps.erase(it);
         }
         else {
             ++it;
         }
     }
 
-    // — Update particles
-    for (auto it = particles.begin(); it != particles.end();) {
-        it->x += it->vx;
-        it->y += it->vy;
-        it->lifetime -= 0.016f;
-        it->alpha = it->lifetime / it->maxLife;
+    // — Move enemy shots
+    TRACE_SPAN(shotPass, "move shots");
+    updateShots(w.shots);
+    TRACE_SPAN_END(shotPass);
 
-        if (it->lifetime <= 0) {
-            it = particles.erase(it);
-        }
-        else {
-            ++it;
-        }
-    }
+    // — Update explosions and particles
+    updateEffects(w);
 
     // — Collisions: bullets vs enemies
-    for (auto b = bullets.begin(); b != bullets.end();) {
+    TRACE_SPAN(bulletPass, "collide bullets");
+    for (auto b = w.bullets.begin(); b != w.bullets.end();) {
         bool hit = false;
-        for (auto e = enemies.begin(); e != enemies.end();) {
+        for (auto e = w.enemies.begin(); e != w.enemies.end();) {
             if (isColliding(*b, *e)) {
-                b = bullets.erase(b);
+                b = w.bullets.erase(b);
 
                 e->health--;
                 if (e->health <= 0) {
                     // Create explosion
-                    explosions.emplace_back(
+                    playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+                    w.explosions.emplace_back(
                         e->x + e->width / 2,
                         e->y + e->height / 2,
                         30.0f + e->type * 10.0f
                     );
 
                     // Create particles
-                    createParticles(
+                    createParticles(w,
                         e->x + e->width / 2,
                         e->y + e->height / 2,
                         10 + e->type * 5,
@@ -625,20 +2281,22 @@ void update(int) {
                     );
 
                     // Check for powerup drop
-                    spawnPowerUp(e->x, e->y);
+                    spawnPowerUp(w, e->x, e->y);
 
                     // Increase score based on enemy type
-                    score += 10 * (e->type + 1);
-                    enemiesDefeated++;
+                    w.score += 10 * (e->type + 1);
+                    w.enemiesDefeated++;
 
                     // Level up check
-                    if (enemiesDefeated >= enemiesForNextLevel && level < MAX_LEVEL) {
-                        levelUp();
+                    if (w.enemiesDefeated >= w.enemiesForNextLevel && w.level < MAX_LEVEL) {
+                        levelUp(w);
                     }
 
-                    e = enemies.erase(e);
+                    scriptEnemyGone(w, *e);
+                    e = w.enemies.erase(e);
                 }
                 else {
+                    scriptEnemyHit(w, *e);
                     ++e;
                 }
 
@@ -651,237 +2309,414 @@ void update(int) {
         }
         if (!hit) ++b;
     }
+    TRACE_SPAN_END(bulletPass);
+
+    // — Collisions: rockets vs enemies, re-indexed after the bullet pass.
+    // Kills only zero the enemy's health so grid indices stay valid; the
+    // dead are swept after the loop.
+    TRACE_SPAN(rocketPass, "collide rockets");
+    if (!w.rockets.empty()) buildEnemyGrid(w);
+    for (auto r = w.rockets.begin(); r != w.rockets.end();) {
+        int target = rocketBlastTarget(w, *r);
+        if (target < 0) {
+            ++r;
+            continue;
+        }
+        r = w.rockets.erase(r);
+        Enemy* e = &w.enemies[target];
+
+        // Create explosion
+        playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+        w.explosions.emplace_back(
+            e->x + e->width / 2,
+            e->y + e->height / 2,
+            50.0f
+        );
+
+        // Create particles
+        createParticles(w,
+            e->x + e->width / 2,
+            e->y + e->height / 2,
+            20,
+            1.0f, 0.3f, 0.0f
+        );
+
+        if (e->type == BOSS_TYPE && e->health > ROCKET_BOSS_DAMAGE) {
+            // Bosses soak rockets
+            e->health -= ROCKET_BOSS_DAMAGE;
+            scriptEnemyHit(w, *e);
+            continue;
+        }
 
-    // — Collisions: rockets vs enemies
-    for (auto r = rockets.begin(); r != rockets.end();) {
-        bool hit = false;
-        for (auto e = enemies.begin(); e != enemies.end();) {
-            GameObject blast(r->x - 10, r->y - 10,
-                r->width + 20, r->height + 20);
-            if (isColliding(blast, *e)) {
-                r = rockets.erase(r);
-
-                // Create explosion
-                explosions.emplace_back(
-                    e->x + e->width / 2,
-                    e->y + e->height / 2,
-                    50.0f
-                );
-
-                // Create particles
-                createParticles(
-                    e->x + e->width / 2,
-                    e->y + e->height / 2,
-                    20,
-                    1.0f, 0.3f, 0.0f
-                );
-
-                // Check for powerup drop (higher chance from rockets)
-                if (rand() % (POWERUP_CHANCE / 2) == 0) {
-                    spawnPowerUp(e->x, e->y);
-                }
-
-                // Rockets always destroy enemies regardless of health
-                score += 30 * (e->type + 1);
-                enemiesDefeated++;
+        // Check for powerup drop (higher chance from rockets)
+        if (worldRand(w) % (POWERUP_CHANCE / 2) == 0) {
+            spawnPowerUp(w, e->x, e->y);
+        }
 
-                // Level up check
-                if (enemiesDefeated >= enemiesForNextLevel && level < MAX_LEVEL) {
-                    levelUp();
-                }
+        // Rockets always destroy enemies regardless of health
+        w.score += 30 * (e->type + 1);
+        w.enemiesDefeated++;
 
-                e = enemies.erase(e);
-                hit = true;
-                break;
-            }
-            else {
-                ++e;
-            }
+        // Level up check
+        if (w.enemiesDefeated >= w.enemiesForNextLevel && w.level < MAX_LEVEL) {
+            levelUp(w);
         }
-        if (!hit) ++r;
-    }
 
-    // — Collisions: player vs enemies
-    if (playerInvulnerableTime <= 0) {
-        for (auto e = enemies.begin(); e != enemies.end();) {
-            if (isColliding(player, *e)) {
-                explosions.emplace_back(
-                    e->x + e->width / 2,
-                    e->y + e->height / 2,
-                    40.0f,
-                    1.0f, 0.0f, 0.0f
-                );
+        scriptEnemyGone(w, *e);
+        e->health = 0;
+    }
+    w.enemies.erase(std::remove_if(w.enemies.begin(), w.enemies.end(),
+        [](const Enemy& e) { return e.health <= 0; }), w.enemies.end());
+    TRACE_SPAN_END(rocketPass);
+
+    // — Collisions: player vs enemies and powerups (team-wide lives and buffs)
+    TRACE_SPAN(shipPass, "collide ships");
+    for (int s = 0; s < w.players; s++) {
+        GameObject& ship = shipOf(w, s);
+        if (w.invulnerableTimer < 0) {
+            for (auto e = w.enemies.begin(); e != w.enemies.end();) {
+                if (isColliding(ship, *e)) {
+                    playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+                    w.explosions.emplace_back(
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        40.0f,
+                        1.0f, 0.0f, 0.0f
+                    );
 
-                createParticles(
-                    e->x + e->width / 2,
-                    e->y + e->height / 2,
-                    15,
-                    1.0f, 0.2f, 0.2f
-                );
+                    createParticles(w,
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        15,
+                        1.0f, 0.2f, 0.2f
+                    );
 
-                e = enemies.erase(e);
+                    // Bosses survive a ram; anything else is destroyed by it
+                    if (e->type == BOSS_TYPE) {
+                        ++e;
+                    }
+                    else {
+                        scriptEnemyGone(w, *e);
+                        e = w.enemies.erase(e);
+                    }
 
-                if (playerShield) {
-                    // Shield absorbs the hit
-                    playerShield = false;
-                    shieldTime = 0;
-                    addMessage("Shield absorbed a collision!");
-                    playerInvulnerableTime = 1.0f;
+                    if (damageShip(w, ship)) return;
                 }
                 else {
-                    // Player loses a life
-                    lives--;
-                    if (lives <= 0) {
-                        gameOver = true;
-
-                        // Big explosion for player death
-                        explosions.emplace_back(
-                            player.x + player.width / 2,
-                            player.y + player.height / 2,
-                            80.0f,
-                            1.0f, 0.0f, 0.0f
-                        );
-
-                        createParticles(
-                            player.x + player.width / 2,
-                            player.y + player.height / 2,
-                            40,
-                            1.0f, 0.5f, 0.2f
-                        );
-
-                        return;
-                    }
-
-                    addMessage("Ship damaged! Life lost.");
-                    playerInvulnerableTime = 3.0f;
+                    ++e;
                 }
             }
-            else {
-                ++e;
+        }
+
+        // — Collisions: player vs enemy shots (re-checked: a ram above may
+        // have started invulnerability)
+        if (w.invulnerableTimer < 0) {
+            int hit = findShotHit(w.shots, ship);
+            if (hit >= 0) {
+                createParticles(w, w.shots.x[hit], w.shots.y[hit], 10, 1.0f, 0.3f, 0.6f);
+                parkShot(w.shots, hit);
+                if (damageShip(w, ship)) return;
             }
         }
-    }
 
-    // — Collisions: player vs powerups
-    // — Collisions: player vs powerups
-    for (auto p = powerUps.begin(); p != powerUps.end();) {
-        if (isColliding(player, *p)) {
-            switch (p->type) {
-            case MULTI_SHOT:
-                multiShot = true;
-                multiShotTime = 10.0f;
-                addMessage("Multi-shot activated!");
-                break;
+        // — Collisions: player vs powerups
+        for (auto p = w.powerUps.begin(); p != w.powerUps.end();) {
+            if (isColliding(ship, *p)) {
+                addModifier(w, ModifierKind(p->type));
+                playSound(w, SOUND_POWERUP, p->x + p->width / 2);
 
-            case SHIELD:
-                playerShield = true;
-                shieldTime = 15.0f;
-                addMessage("Shield activated!");
-                break;
+                // Create powerup pickup effect
+                createParticles(w,
+                    p->x + p->width / 2,
+                    p->y + p->height / 2,
+                    15,
+                    0.5f, 1.0f, 1.0f
+                );
 
-            case SPEED_BOOST:
-                playerSpeedBoost = 2.0f;
-                speedBoostTime = 8.0f;
-                addMessage("Speed boost activated!");
-                break;
+                p = w.powerUps.erase(p);
+            }
+            else {
+                ++p;
             }
-
-            // Create powerup pickup effect
-            createParticles(
-                p->x + p->width / 2,
-                p->y + p->height / 2,
-                15,
-                0.5f, 1.0f, 1.0f
-            );
-
-            p = powerUps.erase(p);
-        }
-        else {
-            ++p;
         }
     }
+    TRACE_SPAN_END(shipPass);
 
     // — Player movement
-    // — Player movement
-    float playerSpeed = 5.0f * playerSpeedBoost;
-    if (moveLeft || specialKeys[GLUT_KEY_LEFT]) {
-        player.x -= playerSpeed;
-    }
-    if (moveRight || specialKeys[GLUT_KEY_RIGHT]) {
-        player.x += playerSpeed;
-    }
-    if (keys['w'] || keys['W'] || specialKeys[GLUT_KEY_UP]) {
-        player.y += playerSpeed;
-    }
-    if (keys['s'] || keys['S'] || specialKeys[GLUT_KEY_DOWN]) {
-        player.y -= playerSpeed;
+    float playerSpeed = 5.0f * speedFactor(w);
+    moveShip(w.player, in, playerSpeed);
+    if (w.players > 1) {
+        moveShip(w.player2, in2, playerSpeed);
     }
+}
 
-    // Keep player in bounds
-    player.x = std::max(0.0f, std::min(player.x, float(windowWidth - player.width)));
-    player.y = std::max(0.0f, std::min(player.y, float(windowHeight - player.height)));
+// Applies one-shot actions for ship `who`, then returns its held input.
+PlayerInput applyInputBits(World& w, int who, unsigned char bits) {
+    if ((bits & INPUT_RESTART) && w.gameOver && who == 0) resetWorld(w);
+    if ((bits & INPUT_FIRE) && !w.gameOver) fireBullet(w, who);
+    if ((bits & INPUT_ROCKET) && !w.gameOver) fireRocket(w, who);
+
+    PlayerInput in;
+    in.left = bits & INPUT_LEFT;
+    in.right = bits & INPUT_RIGHT;
+    in.up = bits & INPUT_UP;
+    in.down = bits & INPUT_DOWN;
+    return in;
 }
 
-void keyboard(unsigned char key, int x, int y) {
-    keys[key] = true;
-    if (key == 'a' || key == 'A') moveLeft = true;
-    if (key == 'd' || key == 'D') moveRight = true;
-    // Immediate actions
-    switch (key) {
-    case ' ': // Fire bullet
-        if (!gameOver) fireBullet();
-        break;
+// A full tick driven by packed inputs, so it can be replayed exactly.
+void tickWorld(World& w, unsigned char bits1, unsigned char bits2 = 0) {
+    PlayerInput in = applyInputBits(w, 0, bits1);
+    PlayerInput in2;
+    if (w.players > 1) in2 = applyInputBits(w, 1, bits2);
+    stepWorld(w, in, in2);
+}
 
-    case 'r':
-    case 'R': // Fire rocket
-        if (!gameOver) fireRocket();
-        break;
+// Restart a finished game in place. Keeps the world's RNG stream running.
+void resetWorld(World& w) {
+    w.player.x = w.players > 1 ? windowWidth / 3 - 25 : windowWidth / 2 - 25;
+    w.player.y = 50;
+    w.player2.x = 2 * windowWidth / 3 - 25;
+    w.player2.y = 50;
+    w.bullets.clear();
+    w.enemies.clear();
+    w.rockets.clear();
+    w.explosions.clear();
+    w.powerUps.clear();
+    w.particles.clear();
+    clearShots(w.shots);
+    w.messageLog.count = 0;
+
+    w.score = 0;
+    w.level = 1;
+    w.lives = 3;
+    w.enemiesDefeated = 0;
+    w.enemiesForNextLevel = levelSpec(1).kills;
+    w.gameOver = false;
+    w.modifiers = ModifierSet();
+    restartTimer(w, w.invulnerableTimer, 3.0f, TIMER_INVULNERABLE);
 
-    case 27: // ESC - quit
-        exit(0);
-        break;
+    // Start enemy spawning
+    if (w.director) attachDirector(w, *w.director);
+    else restartTimer(w, w.spawnTimer, 1.0f, TIMER_SPAWN);
+}
+
+// ────────────────────── Input Queue ──────────────────────
+// Key callbacks only stamp events into a ring. update() drains the ring at
+// the start of each tick and applies the events in order, so held keys and
+// one-shot actions (fire, rocket, restart) land on exact tick boundaries
+// in every mode, netplay included. Holding fire auto-fires at --fire-rate;
+// a tap during the cooldown is kept and fires when the cooldown ends.
+//
+// Each key press is timed from its event to the end of the first frame
+// presented after the tick that applied it, split into the wait for the
+// tick and the tick-to-present part. --input-report prints the histograms
+// at exit.
+const int INPUT_RING = 256;
+const int LATENCY_BUCKETS = 100;   // 1 ms each; the last one takes the rest
+
+struct InputEvent {
+    long long ns;
+    unsigned char key;
+    bool special, down;
+};
+
+struct LatencyHistogram {
+    long long buckets[LATENCY_BUCKETS];
+    long long count;
+    double sumMs, worstMs;
+};
+
+struct InputQueue {
+    InputEvent events[INPUT_RING];
+    unsigned int head, tail;    // callbacks push at head, ticks drain from tail
+    long long dropped;
+
+    int fireTicks;              // ticks between auto-fired shots, 0 for one per press
+    int fireCooldown;
+    bool firePending;
+
+    // Presses applied by a tick but not yet presented
+    long long awaitEventNs[INPUT_RING], awaitTickNs[INPUT_RING];
+    int awaiting;
+    LatencyHistogram toTick, toPresent, total;
+
+    InputQueue()
+        : head(0), tail(0), dropped(0), fireTicks(6), fireCooldown(0), firePending(false),
+        awaiting(0), toTick(), toPresent(), total() {
+    }
+};
+
+InputQueue input;
+
+long long monotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void pushInput(unsigned char key, bool special, bool down) {
+    InputQueue& q = input;
+    if (q.head - q.tail >= unsigned(INPUT_RING)) {
+        q.dropped++;
+        return;
+    }
+    q.events[q.head++ % INPUT_RING] = { monotonicNs(), key, special, down };
+}
+
+bool isGameKey(const InputEvent& e) {
+    if (e.special) {
+        return e.key == GLUT_KEY_LEFT || e.key == GLUT_KEY_RIGHT ||
+            e.key == GLUT_KEY_UP || e.key == GLUT_KEY_DOWN;
+    }
+    return strchr("wasdWASD rRpP", e.key) != nullptr && e.key != 0;
+}
 
-    case 'p':
-    case 'P': // Start a new game if game over
-        if (gameOver) {
-            // Reset game state
-            player.x = windowWidth / 2 - 25;
-            player.y = 50;
-            bullets.clear();
-            enemies.clear();
-            rockets.clear();
-            explosions.clear();
-            powerUps.clear();
-            particles.clear();
-            messageLog.clear();
-
-            score = 0;
-            level = 1;
-            lives = 3;
-            enemiesDefeated = 0;
-            enemiesForNextLevel = 10;
-            gameOver = false;
-            playerShield = false;
-            multiShot = false;
-            playerSpeedBoost = 1.0f;
-            shieldTime = 0.0f;
-            multiShotTime = 0.0f;
-            speedBoostTime = 0.0f;
-            playerInvulnerableTime = 3.0f;
-
-            // Start enemy spawning
-            glutTimerFunc(1000, enemySpawner, 0);
-
-            addMessage("Game started! Good luck!");
+// Applies queued events to the held-key state and returns this tick's
+// one-shot INPUT_* bits.
+unsigned char drainInput(InputQueue& q) {
+    long long now = monotonicNs();
+    unsigned char actions = 0;
+    for (; q.tail != q.head; q.tail++) {
+        const InputEvent& e = q.events[q.tail % INPUT_RING];
+        if (e.special) {
+            specialKeys[e.key] = e.down;
+        }
+        else {
+            keys[e.key] = e.down;
+            if (e.key == 'a' || e.key == 'A') moveLeft = e.down;
+            if (e.key == 'd' || e.key == 'D') moveRight = e.down;
+            if (e.down && e.key == ' ') q.firePending = true;
+            if (e.down && (e.key == 'r' || e.key == 'R')) actions |= INPUT_ROCKET;
+            if (e.down && (e.key == 'p' || e.key == 'P')) actions |= INPUT_RESTART;
         }
+        if (e.down && isGameKey(e) && q.awaiting < INPUT_RING) {
+            q.awaitEventNs[q.awaiting] = e.ns;
+            q.awaitTickNs[q.awaiting++] = now;
+        }
+    }
+
+    if (q.fireCooldown > 0) q.fireCooldown--;
+    bool autoFire = keys[' '] && q.fireTicks > 0;
+    if ((q.firePending || autoFire) && q.fireCooldown == 0) {
+        actions |= INPUT_FIRE;
+        q.firePending = false;
+        q.fireCooldown = q.fireTicks;
+    }
+    return actions;
+}
+
+void addLatency(LatencyHistogram& h, double ms) {
+    h.buckets[std::min(std::max(int(ms), 0), LATENCY_BUCKETS - 1)]++;
+    h.count++;
+    h.sumMs += ms;
+    h.worstMs = std::max(h.worstMs, ms);
+}
+
+// Called once the frame is handed to the display.
+void notePresented(InputQueue& q) {
+    if (q.awaiting == 0) return;
+    long long now = monotonicNs();
+    for (int i = 0; i < q.awaiting; i++) {
+        addLatency(q.toTick, (q.awaitTickNs[i] - q.awaitEventNs[i]) * 1e-6);
+        addLatency(q.toPresent, (now - q.awaitTickNs[i]) * 1e-6);
+        addLatency(q.total, (now - q.awaitEventNs[i]) * 1e-6);
+    }
+    q.awaiting = 0;
+}
+
+// Upper edge of the bucket holding quantile `q`, in ms.
+int latencyPercentile(const LatencyHistogram& h, double q) {
+    long long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h.buckets[i];
+        if (seen >= q * h.count) return i + 1;
+    }
+    return LATENCY_BUCKETS;
+}
+
+void printInputReport() {
+    const InputQueue& q = input;
+    printf("Input latency: %lld key presses, %lld events dropped, auto-fire every %d ticks\n",
+        q.total.count, q.dropped, q.fireTicks);
+    if (q.total.count == 0) return;
+    printf("  stage              mean    p50    p90    p99    max (ms)\n");
+    const LatencyHistogram* stages[3] = { &q.toTick, &q.toPresent, &q.total };
+    const char* names[3] = { "event to tick", "tick to present", "total" };
+    for (int s = 0; s < 3; s++) {
+        const LatencyHistogram& h = *stages[s];
+        printf("  %-16s %6.1f %6d %6d %6d %6.1f\n", names[s], h.sumMs / h.count,
+            latencyPercentile(h, 0.5), latencyPercentile(h, 0.9), latencyPercentile(h, 0.99), h.worstMs);
+    }
+    long long most = *std::max_element(q.total.buckets, q.total.buckets + LATENCY_BUCKETS);
+    printf("  total, 1 ms buckets:\n");
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        long long n = q.total.buckets[i];
+        if (n == 0) continue;
+        char bar[41];
+        int len = int((n * 40 + most - 1) / most);
+        memset(bar, '#', len);
+        bar[len] = 0;
+        printf("  %3d%s ms %-40s %lld\n", i, i == LATENCY_BUCKETS - 1 ? "+" : " ", bar, n);
+    }
+}
+
+void update(int) {
+    endAllocFrame();   // the previous update and display
+    TRACE_SCOPE("update");
+    // Always keep updating the display
+    glutPostRedisplay();
+    glutTimerFunc(16, update, 0);
+
+    unsigned char actions = drainInput(input);
+    bool restarting = (actions & INPUT_RESTART) && world.gameOver;
+    unsigned char bits = actions;
+    if (moveLeft || specialKeys[GLUT_KEY_LEFT]) bits |= INPUT_LEFT;
+    if (moveRight || specialKeys[GLUT_KEY_RIGHT]) bits |= INPUT_RIGHT;
+    if (keys['w'] || keys['W'] || specialKeys[GLUT_KEY_UP]) bits |= INPUT_UP;
+    if (keys['s'] || keys['S'] || specialKeys[GLUT_KEY_DOWN]) bits |= INPUT_DOWN;
+    bool stepped = false;
+#ifndef _WIN32
+    if (netSession) {
+        rollbackFrame(*netSession, bits);
+        stepped = true;
+    }
+#endif
+    if (!stepped) {
+        if (inputLog) fputc(bits, inputLog);
+        stepWorld(world, applyInputBits(world, 0, bits));
+        if (restarting) addMessage(world, "Game started! Good luck!");
+    }
+    if (recorder) {
+        recordStreamFrame(*recorder, world);
+    }
+    queueSounds(world);
+#ifndef _WIN32
+    if (scores) updateScores(*scores, world);
+#endif
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    // Game keys (move, SPACE fire, R rocket, P restart) wait for the tick
+    pushInput(key, false, true);
+    // Front-end keys act at once
+    switch (key) {
+    case 27: // ESC - quit
+        exit(0);
+        break;
+
+    case 't':
+    case 'T': { // Dump the trace rings
+        char msg[MESSAGE_CHARS];
+        if (writeTrace(tracePath)) snprintf(msg, sizeof(msg), "Trace written to %s", tracePath);
+        else snprintf(msg, sizeof(msg), "Tracing needs a -DSHOOTER_TRACE build");
+        addMessage(world, msg);
         break;
     }
+    }
 }
 
 void keyboardUp(unsigned char key, int x, int y) {
-    keys[key] = false;
-    if (key == 'a' || key == 'A') moveLeft = false;
-    if (key == 'd' || key == 'D') moveRight = false;
+    pushInput(key, false, false);
 }
 
 void initStars() {
@@ -895,37 +2730,46 @@ void initStars() {
     }
 }
 
-void drawStars() {
-    float t = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+// The twinkle moves in a few discrete steps, so damage tracking only has
+// to redraw a star when its step changes (see planDamage).
+const int TWINKLE_STEPS = 8;
+float twinkleTime = 0.0f;   // seconds, sampled once per displayed frame
+
+int twinkleStep(const Star& star) {
+    float wave = 0.5f + 0.5f * sin(twinkleTime * 2 + star.x * 0.01f);
+    return int(wave * (TWINKLE_STEPS - 1) + 0.5f);
+}
 
+void drawStars(const ClipRect& clip) {
     for (const auto& star : stars) {
+        if (!overlaps(aroundPoint(star.x, star.y, star.size), clip)) continue;
         // Twinkle effect
-        float brightness = star.baseBright * (0.7f + 0.3f * sin(t * 2 + star.x * 0.01f));
+        float wave = float(twinkleStep(star)) / (TWINKLE_STEPS - 1);
+        float brightness = star.baseBright * (0.4f + 0.6f * wave);
         drawCircle(star.x, star.y, star.size, brightness, brightness, brightness);
     }
 }
 
-void drawGameInterface() {
+void drawGameInterface(const World& w) {
+    ALLOC_SCOPE(ALLOC_HUD);
+    char text[64];   // formatted on the stack so the HUD never allocates
+
     // Score display
-    std::stringstream ss;
-    ss << "SCORE: " << score;
-    drawText(10, windowHeight - 30, ss.str());
+    snprintf(text, sizeof(text), "SCORE: %d", w.score);
+    drawText(10, windowHeight - 30, text);
 
     // Lives display
-    ss.str("");
-    ss << "LIVES: " << lives;
-    drawText(10, windowHeight - 60, ss.str());
+    snprintf(text, sizeof(text), "LIVES: %d", w.lives);
+    drawText(10, windowHeight - 60, text);
 
     // Level display
-    ss.str("");
-    ss << "LEVEL: " << level;
-    drawText(10, windowHeight - 90, ss.str());
+    snprintf(text, sizeof(text), "LEVEL: %d", w.level);
+    drawText(10, windowHeight - 90, text);
 
     // Progress to next level
-    if (level < MAX_LEVEL) {
-        ss.str("");
-        ss << "NEXT LEVEL: " << enemiesDefeated << " / " << enemiesForNextLevel;
-        drawText(windowWidth - 250, windowHeight - 30, ss.str());
+    if (w.level < MAX_LEVEL) {
+        snprintf(text, sizeof(text), "NEXT LEVEL: %d / %d", w.enemiesDefeated, w.enemiesForNextLevel);
+        drawText(windowWidth - 250, windowHeight - 30, text);
     }
     else {
         drawText(windowWidth - 250, windowHeight - 30, "MAX LEVEL REACHED!");
@@ -933,51 +2777,46 @@ void drawGameInterface() {
 
     // Active power-ups display
     float y = 120;
-    if (multiShot) {
-        ss.str("");
-        ss << "Multi-shot: " << int(multiShotTime) << "s";
-        drawSmallText(10, windowHeight - y, ss.str());
-        y += 20;
-    }
-
-    if (playerShield) {
-        ss.str("");
-        ss << "Shield: " << int(shieldTime) << "s";
-        drawSmallText(10, windowHeight - y, ss.str());
+    for (int k = 0; k < MOD_KIND_COUNT; k++) {
+        int stacks = modifierStacks(w, ModifierKind(k));
+        if (stacks == 0) continue;
+        int seconds = int(modifierSeconds(w, ModifierKind(k)));
+        if (stacks > 1) snprintf(text, sizeof(text), "%s x%d: %ds", MODIFIER_DEFS[k].label, stacks, seconds);
+        else snprintf(text, sizeof(text), "%s: %ds", MODIFIER_DEFS[k].label, seconds);
+        drawSmallText(10, windowHeight - y, text);
         y += 20;
     }
 
-    if (playerSpeedBoost > 1.0f) {
-        ss.str("");
-        ss << "Speed Boost: " << int(speedBoostTime) << "s";
-        drawSmallText(10, windowHeight - y, ss.str());
-    }
-
     // Message log display
     y = 50;
-    for (const auto& msg : messageLog) {
-        drawSmallText(windowWidth - 250, y, msg);
+    for (int i = 0; i < w.messageLog.count; i++) {
+        drawSmallText(windowWidth - 250, y, w.messageLog.lines[i]);
         y += 20;
     }
 }
 
-void drawParticles() {
-    for (const auto& p : particles) {
-        drawCircle(p.x, p.y, p.size, p.r, p.g, p.b, p.alpha);
+void drawParticles(const World& w, const ClipRect& clip) {
+    static SpriteBatch batch;
+    for (const auto& p : w.particles) {
+        if (!overlaps(aroundPoint(p.x, p.y, p.size * SPRITE_PAD), clip)) continue;
+        addSprite(batch, p.x, p.y, p.size, p.r, p.g, p.b, p.alpha);
     }
+    drawSprites(batch, SPRITE_EXPLOSION);
 }
 
-void drawExplosions() {
-    for (const auto& e : explosions) {
-        drawCircle(e.x, e.y, e.size, e.r, e.g, e.b, e.alpha);
-        // Inner glow
-        drawCircle(e.x, e.y, e.size * 0.7f, 1.0f, 1.0f, 0.5f, e.alpha * 0.8f);
-        // Core
-        drawCircle(e.x, e.y, e.size * 0.3f, 1.0f, 1.0f, 1.0f, e.alpha * 0.9f);
+// Tinted fireballs, then the inner glow and core on top of them all.
+void drawExplosions(const World& w, const ClipRect& clip) {
+    static SpriteBatch fire, glow;
+    for (const auto& e : w.explosions) {
+        if (!overlaps(aroundPoint(e.x, e.y, e.size * SPRITE_PAD), clip)) continue;
+        addSprite(fire, e.x, e.y, e.size, e.r, e.g, e.b, e.alpha);
+        addSprite(glow, e.x, e.y, e.size, 1.0f, 1.0f, 1.0f, e.alpha);
     }
+    drawSprites(fire, SPRITE_EXPLOSION);
+    drawSprites(glow, SPRITE_GLOW);
 }
 
-void drawGameOverScreen() {
+void drawGameOverScreen(const World& w) {
     // Semi-transparent overlay
     drawRect(0, 0, windowWidth, windowHeight, 0.0f, 0.0f, 0.0f, 0.7f);
 
@@ -986,105 +2825,4338 @@ void drawGameOverScreen() {
    
 
     // Final score
-    std::stringstream ss;
-    ss << "Final Score: " << score;
-    drawText(windowWidth / 2 - 70, windowHeight / 2 - 40, ss.str());
+    char text[64];
+    snprintf(text, sizeof(text), "Final Score: %d", w.score);
+    drawText(windowWidth / 2 - 70, windowHeight / 2 - 40, text);
 
     // Level reached
-    ss.str("");
-    ss << "Highest Level: " << level;
-    drawText(windowWidth / 2 - 70, windowHeight / 2 - 80, ss.str());
+    snprintf(text, sizeof(text), "Highest Level: %d", w.level);
+    drawText(windowWidth / 2 - 70, windowHeight / 2 - 80, text);
 
     // Restart instructions
     drawText(windowWidth / 2 - 120, windowHeight / 2 - 120, " Press 'P' to play again");
 
     drawText(windowWidth / 2 - 160, windowHeight / 2-160, "  Made By-Ria , Shaurya ");
+#ifndef _WIN32
+    if (scores) drawHighScores(*scores);
+#endif
 }
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT);
+// ──────────────────── Damage Tracking ────────────────────
+// Software GL spends most of a frame filling pixels that did not change.
+// With --dirty-rects each frame marks the 32 px tiles covered by every
+// moving drawable, both where it is now and where it was last drawn, plus
+// the HUD when its text changes and stars whose twinkle stepped. Runs of
+// marked tiles are merged into a few rectangles. Frames are drawn into an
+// offscreen canvas that keeps the last frame; only those rectangles are
+// cleared and redrawn (scissored, with culling per rectangle), then the
+// canvas is blitted to the back buffer and swapped as usual. The whole
+// canvas is redrawn when there are too many rectangles, on the game-over
+// screen, and every DAMAGE_REFRESH frames.
+const int DAMAGE_TILE = 32;
+const int DAMAGE_COLS = (windowWidth + DAMAGE_TILE - 1) / DAMAGE_TILE;
+const int DAMAGE_ROWS = (windowHeight + DAMAGE_TILE - 1) / DAMAGE_TILE;
+const int DAMAGE_MAX_RECTS = 32;
+const int DAMAGE_REFRESH = 120;   // frames between full redraws
+
+// Score and level (left), level progress (top right), messages (bottom right)
+const ClipRect HUD_AREAS[] = {
+    { 0.0f, windowHeight - 170.0f, 260.0f, float(windowHeight) },
+    { windowWidth - 260.0f, windowHeight - 40.0f, float(windowWidth), float(windowHeight) },
+    { windowWidth - 260.0f, 44.0f, float(windowWidth), 124.0f },
+};
+
+typedef unsigned char DamageTiles[DAMAGE_ROWS][DAMAGE_COLS];
+
+struct DamageState {
+    DamageTiles last;    // covered by the frame in the canvas
+    DamageTiles now;     // covered by the frame being drawn
+    ClipRect rects[DAMAGE_MAX_RECTS];
+    int rectCount;
+    int frames;
+    unsigned int hud;    // fingerprint of the HUD text last drawn
+    bool valid;          // the canvas holds a complete frame
+};
+
+DamageState damage;
+
+void markTiles(DamageTiles& tiles, const ClipRect& r) {
+    if (!overlaps(r, SCREEN_RECT)) return;
+    int c0 = std::max(int(r.x0) / DAMAGE_TILE, 0);
+    int r0 = std::max(int(r.y0) / DAMAGE_TILE, 0);
+    int c1 = std::min(int(r.x1) / DAMAGE_TILE, DAMAGE_COLS - 1);
+    int r1 = std::min(int(r.y1) / DAMAGE_TILE, DAMAGE_ROWS - 1);
+    for (int y = r0; y <= r1; y++) {
+        for (int x = c0; x <= c1; x++) tiles[y][x] = 1;
+    }
+}
+
+// Changes whenever any HUD line would read differently.
+unsigned int hudFingerprint(const World& w) {
+    unsigned int h = 2166136261u;
+    auto mix = [&h](int v) { h = (h ^ unsigned(v)) * 16777619u; };
+    mix(w.score);
+    mix(w.lives);
+    mix(w.level);
+    mix(w.enemiesDefeated);
+    mix(w.enemiesForNextLevel);
+    for (int k = 0; k < MOD_KIND_COUNT; k++) {
+        int stacks = modifierStacks(w, ModifierKind(k));
+        mix(stacks);
+        if (stacks) mix(int(modifierSeconds(w, ModifierKind(k))));
+    }
+    mix(w.messageLog.count);
+    for (int i = 0; i < w.messageLog.count; i++) {
+        for (const char* c = w.messageLog.lines[i]; *c; c++) mix(*c);
+    }
+    return h;
+}
+
+// Fills d.rects with the regions to redraw. Returns false when the whole
+// window should be redrawn instead.
+bool planDamage(DamageState& d, const World& w) {
+    memset(d.now, 0, sizeof(d.now));
+    for (const auto& b : w.bullets) markTiles(d.now, { b.x, b.y, b.x + b.width, b.y + b.height });
+    for (const auto& r : w.rockets) markTiles(d.now, rocketBounds(r));
+    for (const auto& e : w.enemies) markTiles(d.now, enemyBounds(e));
+    for (size_t i = 0; i < w.shots.size(); i++) {
+        markTiles(d.now, aroundPoint(w.shots.x[i], w.shots.y[i], SHOT_RADIUS * 2));
+    }
+    for (const auto& p : w.powerUps) markTiles(d.now, powerUpBounds(p));
+    markTiles(d.now, shipBounds(w.player));
+    if (w.players > 1) markTiles(d.now, shipBounds(w.player2));
+    for (const auto& p : w.particles) markTiles(d.now, aroundPoint(p.x, p.y, p.size * SPRITE_PAD));
+    for (const auto& e : w.explosions) markTiles(d.now, aroundPoint(e.x, e.y, e.size * SPRITE_PAD));
+
+    DamageTiles dirty;
+    int marked = 0;
+    for (int y = 0; y < DAMAGE_ROWS; y++) {
+        for (int x = 0; x < DAMAGE_COLS; x++) {
+            dirty[y][x] = d.now[y][x] | d.last[y][x];
+        }
+    }
+    unsigned int hud = hudFingerprint(w);
+    if (hud != d.hud) {
+        for (const auto& area : HUD_AREAS) markTiles(dirty, area);
+        d.hud = hud;
+    }
+    for (auto& star : stars) {
+        int step = twinkleStep(star);
+        if (step == star.twinkle) continue;
+        star.twinkle = step;
+        markTiles(dirty, aroundPoint(star.x, star.y, star.size));
+    }
+    memcpy(d.last, d.now, sizeof(d.last));
+
+    bool full = !d.valid || w.gameOver || ++d.frames % DAMAGE_REFRESH == 0;
+    d.valid = true;
+    d.rectCount = 0;
+    if (full) return false;
+
+    // Runs of dirty tiles in each row; a run that matches one in the row
+    // below extends that rectangle upward instead of starting a new one
+    int open[DAMAGE_MAX_RECTS];   // rectangles that reached the previous row
+    int openCount = 0;
+    for (int y = 0; y < DAMAGE_ROWS; y++) {
+        int still[DAMAGE_MAX_RECTS];
+        int stillCount = 0;
+        for (int x = 0; x < DAMAGE_COLS; x++) {
+            if (!dirty[y][x]) continue;
+            int x0 = x;
+            while (x < DAMAGE_COLS && dirty[y][x]) x++;
+            marked += x - x0;
+            float px0 = float(x0 * DAMAGE_TILE), px1 = float(std::min(x * DAMAGE_TILE, windowWidth));
+            float py1 = float(std::min((y + 1) * DAMAGE_TILE, windowHeight));
+            int k = 0;
+            while (k < openCount && (d.rects[open[k]].x0 != px0 || d.rects[open[k]].x1 != px1)) k++;
+            if (k < openCount) {
+                d.rects[open[k]].y1 = py1;
+                still[stillCount++] = open[k];
+                continue;
+            }
+            if (d.rectCount == DAMAGE_MAX_RECTS) return false;
+            d.rects[d.rectCount] = { px0, float(y * DAMAGE_TILE), px1, py1 };
+            still[stillCount++] = d.rectCount++;
+        }
+        memcpy(open, still, sizeof(int) * stillCount);
+        openCount = stillCount;
+    }
+    // Past half the window, one full clear beats many scissored passes
+    return marked * 2 <= DAMAGE_COLS * DAMAGE_ROWS;
+}
 
+// Clears and draws everything that can touch `clip`. buildShotBatch() must
+// have run for this frame.
+void drawScene(const World& w, const ClipRect& clip) {
     // Background - dark space color
     glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
 
     // Draw background stars
-    drawStars();
+    drawStars(clip);
 
     // Draw game objects
-    for (const auto& bullet : bullets) {
+    for (const auto& bullet : w.bullets) {
+        if (!overlaps({ bullet.x, bullet.y, bullet.x + bullet.width, bullet.y + bullet.height }, clip)) continue;
         drawRect(bullet.x, bullet.y, bullet.width, bullet.height, 1.0f, 1.0f, 0.0f);
     }
 
-    for (const auto& rocket : rockets) {
-        drawRocket(rocket);
+    for (const auto& rocket : w.rockets) {
+        if (overlaps(rocketBounds(rocket), clip)) drawRocket(rocket);
     }
 
-    for (const auto& enemy : enemies) {
-        drawEnemy(enemy);
+    for (const auto& enemy : w.enemies) {
+        if (overlaps(enemyBounds(enemy), clip)) drawEnemy(enemy);
     }
 
-    for (const auto& powerUp : powerUps) {
-        drawPowerUp(powerUp);
+    drawEnemyShots(w, clip);
+
+    for (const auto& powerUp : w.powerUps) {
+        if (overlaps(powerUpBounds(powerUp), clip)) drawPowerUp(w, powerUp);
     }
 
     // Draw player
-    drawPlayer();
+    if (overlaps(shipBounds(w.player), clip)) drawPlayer(w);
+    if (w.players > 1 && overlaps(shipBounds(w.player2), clip)) {
+        drawPlayer(w, 1);
+    }
 
     // Draw particles and explosions
-    drawParticles();
-    drawExplosions();
+    drawParticles(w, clip);
+    drawExplosions(w, clip);
 
     // Draw game interface
-    drawGameInterface();
+    for (const auto& area : HUD_AREAS) {
+        if (overlaps(area, clip)) {
+            drawGameInterface(w);
+            break;
+        }
+    }
 
     // Draw game over screen if applicable
-    if (gameOver) {
-        drawGameOverScreen();
+    if (w.gameOver) {
+        drawGameOverScreen(w);
+    }
+}
+
+// The back buffer is undefined after a swap, so damage tracking draws into
+// a window-sized framebuffer object that keeps the last frame. Needs GL 3.0
+// or ARB_framebuffer_object; there is no extension loader on Windows.
+#ifndef _WIN32
+GLuint canvasFbo = 0;
+
+bool initCanvas() {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (!(version && atoi(version) >= 3) &&
+        !(extensions && strstr(extensions, "GL_ARB_framebuffer_object"))) return false;
+    GLuint color;
+    glGenFramebuffers(1, &canvasFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, canvasFbo);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, windowWidth, windowHeight);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
+}
+
+// Always drawn at the game's own size, whatever the window's.
+void bindCanvas() {
+    glBindFramebuffer(GL_FRAMEBUFFER, canvasFbo);
+    glViewport(0, 0, windowWidth, windowHeight);
+}
+
+// Copies the canvas to the back buffer, scaled to the window.
+void blitCanvas() {
+    int width = glutGet(GLUT_WINDOW_WIDTH), height = glutGet(GLUT_WINDOW_HEIGHT);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, canvasFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, windowWidth, windowHeight, 0, 0, width, height,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+}
+#else
+inline bool initCanvas() { return false; }
+inline void bindCanvas() {}
+inline void blitCanvas() {}
+#endif
+
+void display() {
+    TRACE_SCOPE("display");
+    ALLOC_SCOPE(ALLOC_RENDER);
+    bool partial = false;
+    twinkleTime = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+    if (dirtyRects) {
+        partial = planDamage(damage, world);
+        bindCanvas();
+    }
+    buildShotBatch(world);
+
+    if (partial) {
+        glEnable(GL_SCISSOR_TEST);
+        for (int i = 0; i < damage.rectCount; i++) {
+            const ClipRect& r = damage.rects[i];
+            glScissor(GLint(r.x0), GLint(r.y0), GLsizei(r.x1 - r.x0), GLsizei(r.y1 - r.y0));
+            drawScene(world, r);
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+    else {
+        drawScene(world, SCREEN_RECT);
     }
 
+    TRACE_SCOPE("swap buffers");
+    if (dirtyRects) blitCanvas();
     glutSwapBuffers();
+    notePresented(input);
 }
 
-int main(int argc, char** argv) {
-    // Initialize GLUT
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
-    glutInitWindowSize(windowWidth, windowHeight);
-    glutInitWindowPosition(100, 100);
-    glutCreateWindow("Space Shooter");
+// ───────────────────── Wave Scripts ─────────────────────
+// Spawning is scripted with C++20 coroutines. A campaign script launches a
+// steady stream of singles, formation waves and bosses. Each one suspends
+// on a sim-time event: a tick, N enemies cleared, a level reached, or a
+// watched enemy's health. Suspended scripts sit in per-event wait lists, so
+// a step only touches the scripts that are ready. Frames come from a block
+// arena sized at setup, so launching a script never allocates.
+//
+// Coroutine frames can't be copied into rollback snapshots, so a World only
+// points at its director. Netplay worlds leave it null and keep the timer
+// spawner.
+const int SCRIPT_FRAME_BYTES = 256;   // largest frame the arena hands out
+const int DEFAULT_SCRIPTS = 32;       // frames per director
+
+// Fixed-size blocks carved from one buffer at setup and recycled through a
+// free list. Each block's header points back at its arena for the free.
+struct ScriptArena {
+    struct alignas(16) Header {
+        ScriptArena* arena;
+        Header* next;   // free list link while the block is unused
+    };
+    static const size_t STRIDE = sizeof(Header) + SCRIPT_FRAME_BYTES;
+
+    std::vector<unsigned char> buffer;
+    Header* freeList;
+    int used, peak, failed;
+
+    ScriptArena(int blocks)
+        : buffer(blocks * STRIDE), freeList(nullptr), used(0), peak(0), failed(0) {
+        for (int i = blocks - 1; i >= 0; i--) {
+            Header* h = reinterpret_cast<Header*>(&buffer[i * STRIDE]);
+            h->arena = this;
+            h->next = freeList;
+            freeList = h;
+        }
+    }
+};
 
-    // Set up 2D projection
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluOrtho2D(0, windowWidth, 0, windowHeight);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+void* arenaAlloc(ScriptArena& a, size_t size) {
+    if (size > size_t(SCRIPT_FRAME_BYTES) || !a.freeList) {
+        a.failed++;
+        return nullptr;
+    }
+    ScriptArena::Header* h = a.freeList;
+    a.freeList = h->next;
+    a.peak = std::max(a.peak, ++a.used);
+    return h + 1;
+}
 
-    // Enable blending for transparency
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+void arenaFree(void* frame) {
+    ScriptArena::Header* h = static_cast<ScriptArena::Header*>(frame) - 1;
+    ScriptArena& a = *h->arena;
+    h->next = a.freeList;
+    a.freeList = h;
+    a.used--;
+}
 
-    // Initialize random seed
-    std::srand(std::time(nullptr));
+struct ScriptDirector;
 
-    // Create starfield
-    initStars();
+// Fire-and-forget script coroutine. Every script takes its director as the
+// first parameter, which places the frame in that director's arena;
+// launchScript starts it and the frame frees itself when the body ends.
+struct Script {
+    struct promise_type {
+        ScriptDirector* director;
+        promise_type* prevLive;   // director's list of unfinished scripts
+        promise_type* nextLive;
 
-    // Register callbacks
-    glutDisplayFunc(display);
-    glutTimerFunc(16, update, 0);
-    glutKeyboardFunc(keyboard);
-    glutKeyboardUpFunc(keyboardUp);
-    glutSpecialFunc(specialKey);
-    glutSpecialUpFunc(specialKeyUp);
-    // Start enemy spawning
-    glutTimerFunc(1000, enemySpawner, 0);
+        template <typename... Args>
+        promise_type(ScriptDirector& d, Args&...)
+            : director(&d), prevLive(nullptr), nextLive(nullptr) {
+        }
+        ~promise_type();
+
+        template <typename... Args>
+        static void* operator new(size_t size, ScriptDirector& d, Args&...) noexcept;
+        static void operator delete(void* frame) { arenaFree(frame); }
+        static Script get_return_object_on_allocation_failure() { return Script(); }
+
+        Script get_return_object() {
+            return Script(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;   // null when the arena was full
+
+    Script() {}
+    explicit Script(std::coroutine_handle<promise_type> h) : handle(h) {}
+};
+
+enum ScriptWaitKind { WAIT_TICKS, WAIT_CLEARED, WAIT_LEVEL, WAIT_HEALTH };
+
+struct ScriptWaiter {
+    unsigned int key;   // wake tick, cleared count, level or health threshold
+    unsigned int seq;   // FIFO among equal keys
+    unsigned int id;    // watched enemy, WAIT_HEALTH only
+    std::coroutine_handle<> handle;
+};
+
+struct ScriptDirector {
+    ScriptArena arena;
+    World* world;                          // bound each step by runScripts
+    Script::promise_type* live;            // every unfinished script, for stopScripts
+    std::vector<ScriptWaiter> sleeping;    // min-heap on wake tick
+    std::vector<ScriptWaiter> clearing;    // min-heap on cleared count
+    std::vector<ScriptWaiter> leveling;    // waits on a level being reached
+    std::vector<ScriptWaiter> watching;    // waits on a watched enemy's health
+    std::vector<std::coroutine_handle<>> ready;
+    unsigned int cleared;   // enemies that have left play, destroyed or escaped
+    unsigned int seq;
+    unsigned int bossId;    // boss on screen, 0 when none
+    long long resumes;
+
+    ScriptDirector(int capacity = DEFAULT_SCRIPTS)
+        : arena(capacity), world(nullptr), live(nullptr),
+        cleared(0), seq(0), bossId(0), resumes(0) {
+        // A frame waits in at most one list, so none of these grow after setup
+        sleeping.reserve(capacity);
+        clearing.reserve(capacity);
+        leveling.reserve(capacity);
+        watching.reserve(capacity);
+        ready.reserve(capacity);
+    }
+    ~ScriptDirector();
+    ScriptDirector(const ScriptDirector&) = delete;
+    ScriptDirector& operator=(const ScriptDirector&) = delete;
+};
+
+template <typename... Args>
+void* Script::promise_type::operator new(size_t size, ScriptDirector& d, Args&...) noexcept {
+    return arenaAlloc(d.arena, size);
+}
+
+Script::promise_type::~promise_type() {
+    if (prevLive) prevLive->nextLive = nextLive;
+    else director->live = nextLive;
+    if (nextLive) nextLive->prevLive = prevLive;
+}
+
+// Starts a script, running it to its first wait. False when the arena was
+// full and the script never got a frame.
+bool launchScript(ScriptDirector& d, Script s) {
+    if (!s.handle) return false;
+    Script::promise_type& p = s.handle.promise();
+    p.nextLive = d.live;
+    if (d.live) d.live->prevLive = &p;
+    d.live = &p;
+    s.handle.resume();
+    return true;
+}
+
+// Destroys every suspended script and forgets all waits.
+void stopScripts(ScriptDirector& d) {
+    while (d.live) {
+        std::coroutine_handle<Script::promise_type>::from_promise(*d.live).destroy();
+    }
+    d.sleeping.clear();
+    d.clearing.clear();
+    d.leveling.clear();
+    d.watching.clear();
+    d.ready.clear();
+    d.cleared = 0;
+    d.bossId = 0;
+}
+
+ScriptDirector::~ScriptDirector() {
+    stopScripts(*this);
+}
+
+bool waiterAfter(const ScriptWaiter& a, const ScriptWaiter& b) {
+    return a.key != b.key ? a.key > b.key : a.seq > b.seq;
+}
+
+Enemy* findEnemy(World& w, unsigned int id) {
+    for (auto& e : w.enemies) {
+        if (e.id == id) return &e;
+    }
+    return nullptr;
+}
+
+// Awaitable returned by the wait functions below.
+struct ScriptWait {
+    ScriptDirector* d;
+    ScriptWaitKind kind;
+    unsigned int key;
+    unsigned int id;
+
+    bool await_ready() const {
+        World& w = *d->world;
+        switch (kind) {
+        case WAIT_TICKS: return key <= w.tick;
+        case WAIT_CLEARED: return key <= d->cleared;
+        case WAIT_LEVEL: return key <= unsigned(w.level);
+        case WAIT_HEALTH: {
+            Enemy* e = findEnemy(w, id);
+            if (!e || e->health <= int(key)) return true;
+            e->watched = true;   // its hits and removal now notify the director
+            return false;
+        }
+        }
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) const {
+        ScriptWaiter waiter = { key, d->seq++, id, h };
+        switch (kind) {
+        case WAIT_TICKS:
+            d->sleeping.push_back(waiter);
+            std::push_heap(d->sleeping.begin(), d->sleeping.end(), waiterAfter);
+            break;
+        case WAIT_CLEARED:
+            d->clearing.push_back(waiter);
+            std::push_heap(d->clearing.begin(), d->clearing.end(), waiterAfter);
+            break;
+        case WAIT_LEVEL:
+            d->leveling.push_back(waiter);
+            break;
+        case WAIT_HEALTH:
+            d->watching.push_back(waiter);
+            break;
+        }
+    }
+
+    void await_resume() const {}
+};
+
+ScriptWait waitTicks(ScriptDirector& d, unsigned int ticks) {
+    return { &d, WAIT_TICKS, d.world->tick + ticks, 0 };
+}
+
+ScriptWait waitSeconds(ScriptDirector& d, float seconds) {
+    return waitTicks(d, secondsToTicks(seconds));
+}
+
+// Until `count` more enemies have left play, destroyed or escaped.
+ScriptWait waitCleared(ScriptDirector& d, int count) {
+    return { &d, WAIT_CLEARED, d.cleared + unsigned(count), 0 };
+}
+
+ScriptWait waitLevel(ScriptDirector& d, int level) {
+    return { &d, WAIT_LEVEL, unsigned(level), 0 };
+}
+
+// Until enemy `id` is down to `health` or has left play.
+ScriptWait waitHealth(ScriptDirector& d, unsigned int id, int health) {
+    return { &d, WAIT_HEALTH, unsigned(std::max(health, 0)), id };
+}
+
+ScriptWait waitGone(ScriptDirector& d, unsigned int id) {
+    return waitHealth(d, id, 0);
+}
+
+// Moves matching watchers to the ready list.
+void wakeWatchers(ScriptDirector& d, unsigned int id, int health) {
+    for (size_t i = 0; i < d.watching.size();) {
+        if (d.watching[i].id == id && health <= int(d.watching[i].key)) {
+            d.ready.push_back(d.watching[i].handle);
+            d.watching[i] = d.watching.back();
+            d.watching.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+// Notifications from the step only queue scripts; they resume at the start
+// of the next step, never while the step is iterating entities.
+void scriptEnemyHit(World& w, const Enemy& e) {
+    if (w.director && e.watched) wakeWatchers(*w.director, e.id, e.health);
+}
+
+void scriptEnemyGone(World& w, const Enemy& e) {
+    if (!w.director) return;
+    ScriptDirector& d = *w.director;
+    d.cleared++;
+    while (!d.clearing.empty() && d.clearing.front().key <= d.cleared) {
+        std::pop_heap(d.clearing.begin(), d.clearing.end(), waiterAfter);
+        d.ready.push_back(d.clearing.back().handle);
+        d.clearing.pop_back();
+    }
+    if (e.watched) wakeWatchers(d, e.id, 0);
+}
+
+void scriptLevelUp(World& w) {
+    if (!w.director) return;
+    ScriptDirector& d = *w.director;
+    for (size_t i = 0; i < d.leveling.size();) {
+        if (d.leveling[i].key <= unsigned(w.level)) {
+            d.ready.push_back(d.leveling[i].handle);
+            d.leveling[i] = d.leveling.back();
+            d.leveling.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+// Resumes every script whose event has happened. Idle cost is one look at
+// the top of the sleep heap.
+void runScripts(ScriptDirector& d, World& w) {
+    TRACE_SCOPE("runScripts");
+    ALLOC_SCOPE(ALLOC_SCRIPTS);
+    d.world = &w;
+    while (!d.sleeping.empty() && d.sleeping.front().key <= w.tick) {
+        std::pop_heap(d.sleeping.begin(), d.sleeping.end(), waiterAfter);
+        d.ready.push_back(d.sleeping.back().handle);
+        d.sleeping.pop_back();
+    }
+    // Index loop: resumed scripts may queue more (e.g. by launching children)
+    for (size_t i = 0; i < d.ready.size(); i++) {
+        d.resumes++;
+        d.ready[i].resume();
+    }
+    d.ready.clear();
+}
+
+int bossHealth(int level) {
+    return 30 + 5 * level;
+}
+
+bool bossAlive(ScriptDirector& d) {
+    return d.bossId && findEnemy(*d.world, d.bossId);
+}
+
+// Steady singles on a level-scaled cadence (the old timer spawner); pauses
+// while a boss is up.
+Script streamScript(ScriptDirector& d) {
+    for (;;) {
+        if (bossAlive(d)) {
+            co_await waitGone(d, d.bossId);
+            continue;
+        }
+        createEnemy(*d.world);
+        co_await waitSeconds(d, levelSpec(d.world->level).spawnSeconds);
+    }
+}
+
+enum Formation { FORMATION_LINE, FORMATION_VEE, FORMATION_COLUMN, FORMATION_COUNT };
+
+Script formationScript(ScriptDirector& d, Formation shape, int count) {
+    World& w = *d.world;   // only used before the first wait
+    int type = rollEnemyType(w);
+    float cx = float(worldRand(w) % (windowWidth - 40));
+    float span = float(windowWidth) / count;
+
+    switch (shape) {
+    case FORMATION_LINE:
+        // A full row at once
+        for (int i = 0; i < count; i++) {
+            spawnEnemyAt(w, span * i + (span - 40) / 2, type);
+        }
+        break;
+
+    case FORMATION_VEE:
+        // Point first, then mirrored pairs trailing out behind it
+        spawnEnemyAt(w, cx, type);
+        for (int i = 1; i <= count / 2; i++) {
+            co_await waitSeconds(d, 0.25f);
+            spawnEnemyAt(*d.world, cx - 45.0f * i, type);
+            spawnEnemyAt(*d.world, cx + 45.0f * i, type);
+        }
+        break;
+
+    case FORMATION_COLUMN:
+        // Single file down one lane
+        for (int i = 0; i < count; i++) {
+            if (i > 0) co_await waitSeconds(d, 0.35f);
+            spawnEnemyAt(*d.world, cx, type);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// One formation per batch of enemies cleared, for as long as `level` lasts.
+Script wavesScript(ScriptDirector& d, int level) {
+    for (;;) {
+        co_await waitCleared(d, 8 + 2 * level);
+        if (d.world->level != level) co_return;
+        if (bossAlive(d)) continue;
+        Formation shape = Formation(worldRand(*d.world) % FORMATION_COUNT);
+        launchScript(d, formationScript(d, shape, 3 + level / 3));
+    }
+}
+
+// Pairs from the boss's flanks, faster each phase, until it falls.
+Script escortScript(ScriptDirector& d, unsigned int bossId) {
+    for (;;) {
+        Enemy* boss = findEnemy(*d.world, bossId);
+        if (!boss) co_return;
+        float x = boss->x, y = boss->y, width = boss->width;
+        int phase = boss->phase;   // copied out: spawning may move the enemy vector
+        if (Enemy* e = spawnEnemyAt(*d.world, x - 30, 0)) e->y = y;
+        if (Enemy* e = spawnEnemyAt(*d.world, x + width - 10, 0)) e->y = y;
+        co_await waitSeconds(d, 3.0f - phase);
+    }
+}
+
+void setBossPhase(ScriptDirector& d, unsigned int id, int phase, const char* message) {
+    Enemy* boss = findEnemy(*d.world, id);
+    if (!boss) return;
+    boss->phase = phase;
+    boss->vx *= 1.5f;
+    addMessage(*d.world, message);
+}
+
+// Warning, then a boss whose phases follow its remaining health.
+Script bossScript(ScriptDirector& d) {
+    addMessage(*d.world, "WARNING: BOSS APPROACHING!");
+    co_await waitSeconds(d, 2.0f);
+
+    int level = d.world->level;
+    Enemy* spawned;
+    while (!(spawned = spawnEnemyAt(*d.world, windowWidth / 2 - 60, BOSS_TYPE))) {
+        co_await waitSeconds(d, 0.5f);   // only if an earlier boss holds the last slot
+    }
+    Enemy& boss = *spawned;
+    boss.health = boss.maxHealth = bossHealth(level);
+    boss.vx = 2.0f;
+    unsigned int id = boss.id;
+    int full = boss.maxHealth;
+    d.bossId = id;
+    launchScript(d, escortScript(d, id));
+
+    co_await waitHealth(d, id, full * 2 / 3);
+    setBossPhase(d, id, 1, "The boss is enraged!");
+    co_await waitHealth(d, id, full / 3);
+    setBossPhase(d, id, 2, "The boss is diving!");
+    co_await waitGone(d, id);
+
+    d.bossId = 0;
+    d.world->score += 200 * level;
+    addMessage(*d.world, "BOSS DEFEATED!");
+}
+
+Script campaignScript(ScriptDirector& d) {
+    co_await waitSeconds(d, 1.0f);   // same grace period as the timer spawner
+    launchScript(d, streamScript(d));
+    for (int level = d.world->level; ; level++) {
+        launchScript(d, wavesScript(d, level));
+        if (level >= MAX_LEVEL) co_return;
+        co_await waitLevel(d, level + 1);
+        if ((level + 1) % BOSS_LEVEL_INTERVAL == 0) launchScript(d, bossScript(d));
+    }
+}
+
+// Hands the world's spawning to `d`: stops the timer spawner and (re)starts
+// the campaign.
+void attachDirector(World& w, ScriptDirector& d) {
+    cancelTimer(w.timers, w.spawnTimer);
+    stopScripts(d);
+    w.director = &d;
+    d.world = &w;
+    launchScript(d, campaignScript(d));
+}
+
+// ───────────────────── Batch Runner ─────────────────────
+// Headless Monte Carlo mode for balance tuning: thousands of seeded,
+// bot-driven games spread across all cores, one World per game and no
+// GLUT calls anywhere on this path.
+struct GameResult {
+    int ticks;
+    int score;
+    int level;
+    bool timedOut;
+};
+
+// Simple autopilot: chase the lowest enemy, fire on a cooldown, and spend a
+// rocket whenever something gets close to the base. Returns INPUT_* bits.
+struct Bot {
+    int fireCooldown;
+    int rocketCooldown;
+    Bot() : fireCooldown(0), rocketCooldown(0) {}
+};
+
+unsigned char botThink(const World& w, Bot& bot, int who = 0) {
+    if (w.gameOver) return INPUT_RESTART;
+    if (bot.fireCooldown > 0) bot.fireCooldown--;
+    if (bot.rocketCooldown > 0) bot.rocketCooldown--;
+
+    const Enemy* target = nullptr;
+    for (const auto& e : w.enemies) {
+        if (!target || e.y < target->y) target = &e;
+    }
+    if (!target) return 0;
+
+    unsigned char bits = 0;
+    const GameObject& ship = shipOf(w, who);
+    float cx = ship.x + ship.width / 2;
+    float tx = target->x + target->width / 2;
+    if (tx < cx - 4) bits |= INPUT_LEFT;
+    else if (tx > cx + 4) bits |= INPUT_RIGHT;
+
+    // Sidestep shots falling into the ship's lane, away from the nearer side
+    float threat = 0.0f;
+    for (size_t i = 0; i < w.shots.size(); i++) {
+        float x = w.shots.x[i], y = w.shots.y[i];
+        if (w.shots.vy[i] < 0 && x >= ship.x - 20 && x <= ship.x + ship.width + 20 &&
+            y >= ship.y && y <= ship.y + 120) {
+            threat += x < cx ? 1.0f : -1.0f;
+        }
+    }
+    if (threat != 0.0f) {
+        bits &= ~(INPUT_LEFT | INPUT_RIGHT);
+        bits |= threat > 0 ? INPUT_RIGHT : INPUT_LEFT;
+    }
+
+    if (bot.fireCooldown == 0 && std::fabs(tx - cx) < 30) {
+        bits |= INPUT_FIRE;
+        bot.fireCooldown = 6;
+    }
+    if (bot.rocketCooldown == 0 && target->y < windowHeight / 3) {
+        bits |= INPUT_ROCKET;
+        bot.rocketCooldown = 90;
+    }
+    return bits;
+}
+
+// splitmix-style scramble so neighbouring game indices get unrelated streams.
+unsigned int mixSeed(unsigned int x) {
+    x += 0x9e3779b9u;
+    x = (x ^ (x >> 16)) * 0x85ebca6bu;
+    x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+    return x ^ (x >> 16);
+}
+
+GameResult runHeadlessGame(unsigned int seed, int maxTicks) {
+    ScriptDirector scripts;
+    World w(mixSeed(seed));
+    reserveWorld(w);
+    attachDirector(w, scripts);
+    Bot bot;
+    int tick = 0;
+    while (!w.gameOver && tick < maxTicks) {
+        tickWorld(w, botThink(w, bot));
+        endAllocFrame();
+        tick++;
+    }
+    GameResult r = { tick, w.score, w.level, !w.gameOver };
+    return r;
+}
+
+// Value at fraction q of an ascending-sorted sample.
+float percentile(const std::vector<float>& sorted, float q) {
+    if (sorted.empty()) return 0.0f;
+    size_t i = size_t(q * (sorted.size() - 1) + 0.5f);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void printDistribution(const char* label, std::vector<float> v) {
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (float x : v) sum += x;
+    printf("%-14s mean %9.1f  p10 %9.1f  p50 %9.1f  p90 %9.1f  max %9.1f\n",
+        label, v.empty() ? 0.0 : sum / v.size(),
+        percentile(v, 0.1f), percentile(v, 0.5f), percentile(v, 0.9f),
+        v.empty() ? 0.0f : v.back());
+}
+
+int runBatch(int games, int threads, unsigned int seed, int maxTicks) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, games);
+
+    std::vector<GameResult> results(games);
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        TRACE_THREAD("batch worker");
+        for (int i = next++; i < games; i = next++) {
+            results[i] = runHeadlessGame(seed + i, maxTicks);
+        }
+        mergeAllocStats();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<float> survival, scores;
+    int levelCounts[MAX_LEVEL + 2] = { 0 };
+    int timedOut = 0;
+    long long totalTicks = 0;
+    for (const auto& r : results) {
+        survival.push_back(r.ticks * TICK_SECONDS);
+        scores.push_back(float(r.score));
+        levelCounts[std::min(r.level, MAX_LEVEL + 1)]++;
+        timedOut += r.timedOut;
+        totalTicks += r.ticks;
+    }
+
+    printf("Batch: %d games, %d threads, seed %u, max %d ticks\n", games, threads, seed, maxTicks);
+    printf("Throughput:    %.1f games/s/core  (%.1f games/s, %.2fM ticks/s, %.2fs wall)\n",
+        games / secs / threads, games / secs, totalTicks / secs / 1e6, secs);
+    printDistribution("Survival (s):", survival);
+    printDistribution("Score:", scores);
+    printf("Level reached:");
+    for (int l = 1; l <= MAX_LEVEL + 1; l++) {
+        if (levelCounts[l]) printf("  L%d %.1f%%", l, 100.0 * levelCounts[l] / games);
+    }
+    printf("\nTimed out:     %d\n", timedOut);
+    return 0;
+}
+
+// Bullet-hell load test (--bullet-bench): keeps `target` enemy shots alive
+// in a bot-flown world and times each step plus the vertex fill the draw
+// path does, against a 60 Hz frame budget.
+int runBulletBench(int target, int ticks, unsigned int seed) {
+    const float budgetUs = 16000.0f;
+    World w(mixSeed(seed));
+    w.lives = 1 << 30;   // hits take the full damage path but never end the run
+    Bot bot;
+    std::vector<float> stepUs, fillUs, frameUs;
+    std::vector<float> verts;
+    double liveShots = 0;
+
+    for (int t = 0; t < ticks; t++) {
+        // Top up with rings from random points in the upper half
+        while (int(w.shots.size()) < target) {
+            float x = float(worldRand(w) % windowWidth);
+            float y = float(windowHeight / 2 + worldRand(w) % (windowHeight / 2));
+            emitRadial(w.shots, x, y, 32, 1.0f + (worldRand(w) % 100) * 0.01f,
+                (worldRand(w) % 628) * 0.01f);
+        }
+        liveShots += w.shots.size();
+
+        auto t0 = std::chrono::steady_clock::now();
+        tickWorld(w, botThink(w, bot));
+        auto t1 = std::chrono::steady_clock::now();
+        buildShotQuads(w.shots, SHOT_RADIUS * 2, verts);
+        buildShotQuads(w.shots, SHOT_RADIUS, verts);
+        auto t2 = std::chrono::steady_clock::now();
+
+        stepUs.push_back(std::chrono::duration<float, std::micro>(t1 - t0).count());
+        fillUs.push_back(std::chrono::duration<float, std::micro>(t2 - t1).count());
+        frameUs.push_back(stepUs.back() + fillUs.back());
+    }
+
+    printf("Bullet bench: %d shots target (%.0f live on average), %d ticks, seed %u\n",
+        target, liveShots / ticks, ticks, seed);
+    printDistribution("Step (us):", stepUs);
+    printDistribution("Fill (us):", fillUs);
+    std::sort(frameUs.begin(), frameUs.end());
+    bool pass = frameUs.back() < budgetUs;
+    printf("Frame budget:  %.0f us, worst step + fill %.1f us (p99 %.1f us): %s\n",
+        budgetUs, frameUs.back(), percentile(frameUs, 0.99f), pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// ──────────────────── Differential Testing ────────────────────
+// stepWorld() is free to get faster; it is not free to play differently.
+// stepWorldReference() below is the simulation written the plain way: a
+// frozen copy of the step loop with brute-force scans and scalar loops
+// where stepWorld uses grids and SIMD. --diff-test steps a pair of worlds,
+// one with each, from the same seed and input every tick and compares them
+// field by field (floats by bit pattern), stopping at the first divergence.
+// Optimize stepWorld and its kernels; change the reference only when the
+// gameplay itself is meant to change.
+
+// Scalar shot integration and the same in-order compaction.
+void updateShotsReference(EnemyShots& s) {
+    size_t kept = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        float x = s.x[i] + s.vx[i];
+        float y = s.y[i] + s.vy[i];
+        if (x < -SHOT_RADIUS || x > windowWidth + SHOT_RADIUS ||
+            y < -SHOT_RADIUS || y > windowHeight + SHOT_RADIUS) continue;
+        s.x[kept] = x;
+        s.y[kept] = y;
+        s.vx[kept] = s.vx[i];
+        s.vy[kept] = s.vy[i];
+        kept++;
+    }
+    s.x.resize(kept);
+    s.y.resize(kept);
+    s.vx.resize(kept);
+    s.vy.resize(kept);
+}
+
+// Oldest shot touching the rectangle, or -1.
+int findShotHitReference(const EnemyShots& s, const GameObject& box) {
+    for (size_t i = 0; i < s.size(); i++) {
+        float dx = s.x[i] - std::max(box.x, std::min(s.x[i], box.x + box.width));
+        float dy = s.y[i] - std::max(box.y, std::min(s.y[i], box.y + box.height));
+        if (dx * dx + dy * dy <= SHOT_RADIUS * SHOT_RADIUS) return int(i);
+    }
+    return -1;
+}
+
+// Nearest enemy by centre, the earliest spawned on a tie.
+void steerRocketReference(const World& w, Rocket& r) {
+    float cx = r.x + r.width / 2, cy = r.y + r.height / 2;
+    int nearest = -1;
+    float best = 0.0f;
+    for (size_t i = 0; i < w.enemies.size(); i++) {
+        float dx = w.enemies[i].x + w.enemies[i].width / 2 - cx;
+        float dy = w.enemies[i].y + w.enemies[i].height / 2 - cy;
+        float d = dx * dx + dy * dy;
+        if (nearest < 0 || d < best) {
+            nearest = int(i);
+            best = d;
+        }
+    }
+    if (nearest < 0) return;
+    const Enemy& e = w.enemies[nearest];
+    float heading = std::atan2(r.vy, r.vx);
+    float turn = std::atan2(e.y + e.height / 2 - cy, e.x + e.width / 2 - cx) - heading;
+    if (turn > 3.1415926f) turn -= 6.2831853f;
+    if (turn < -3.1415926f) turn += 6.2831853f;
+    heading += std::max(-ROCKET_TURN, std::min(turn, ROCKET_TURN));
+    r.vx = std::cos(heading) * ROCKET_SPEED;
+    r.vy = std::sin(heading) * ROCKET_SPEED;
+}
+
+// First live enemy in spawn order touching the rocket's blast box, or -1.
+int rocketBlastTargetReference(const World& w, const Rocket& r) {
+    GameObject blast = rocketBlast(r);
+    for (size_t i = 0; i < w.enemies.size(); i++) {
+        if (w.enemies[i].health > 0 && isColliding(blast, w.enemies[i])) return int(i);
+    }
+    return -1;
+}
+
+void updateEffectsReference(World& w) {
+    for (auto it = w.explosions.begin(); it != w.explosions.end();) {
+        it->alpha -= 0.04f;
+        it->size += 2.0f;
+        if (it->alpha <= 0) {
+            it = w.explosions.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    for (auto it = w.particles.begin(); it != w.particles.end();) {
+        it->x += it->vx;
+        it->y += it->vy;
+        it->lifetime -= 0.016f;
+        it->alpha = it->lifetime / it->maxLife;
+
+        if (it->lifetime <= 0) {
+            it = w.particles.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+// stepWorld() pass for pass, with the kernels above in place of the grid
+// and SIMD ones. The order of every pass and erase loop is part of the
+// specification: it decides which enemy a bullet hits first. The two must
+// be kept in step: a gameplay change to stepWorld is made here too, line
+// for line, down to where each value is rounded to float.
+void stepWorldReference(World& w, const PlayerInput& in, const PlayerInput& in2) {
+    if (w.gameOver) {
+        return;
+    }
+
+    w.simTime += TICK_SECONDS;
+    w.tick++;
+    float currentTime = w.simTime;
+
+    // — Fire due timers (enemy spawns, invulnerability) and expire power-ups
+    advanceTimerWheel(w.timers, [&](TimerEvent event) { onTimer(w, event); });
+    expireModifiers(w);
+
+    // — Resume wave scripts whose events have happened
+    if (w.director) runScripts(*w.director, w);
+
+    // — Move bullets
+    for (auto it = w.bullets.begin(); it != w.bullets.end();) {
+        float vx = sin(it->angle) * BULLET_SPEED;
+        float vy = cos(it->angle) * BULLET_SPEED;
+        it->x += vx;
+        it->y += vy;
+
+        if (it->y > windowHeight || it->x < 0 || it->x > windowWidth) {
+            it = w.bullets.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // — Move enemies
+    for (auto it = w.enemies.begin(); it != w.enemies.end();) {
+        if (it->type == BOSS_TYPE) {
+            moveBoss(*it);
+            enemyFire(w, *it);
+            ++it;
+            continue;
+        }
+
+        it->y -= levelSpec(w.level).enemySpeed[it->type];
+
+        // Advanced enemies move in patterns
+        if (it->type == 1) {
+            it->x += sin(currentTime * 2 + it->y * 0.01f) * 2;
+        }
+        else if (it->type == 2) {
+            it->x += sin(currentTime * 3 + it->y * 0.02f) * 3;
+        }
+
+        // Keep enemies within screen bounds
+        it->x = std::max(0.0f, std::min(it->x, float(windowWidth - it->width)));
+        enemyFire(w, *it);
+
+        if (it->y < 0) {
+            scriptEnemyGone(w, *it);
+            it = w.enemies.erase(it);
+            if (--w.lives <= 0) {
+                w.gameOver = true;
+                return;
+            }
+            addMessage(w, "Enemy reached the base! Life lost.");
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // — Steer and move rockets
+    for (auto it = w.rockets.begin(); it != w.rockets.end();) {
+        steerRocketReference(w, *it);
+        it->x += it->vx;
+        it->y += it->vy;
+        if (it->y > windowHeight || it->y < -it->height || it->x < -it->width ||
+            it->x > windowWidth || w.simTime - it->spawnTime > ROCKET_LIFETIME) {
+            it = w.rockets.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // — Move power-ups
+    for (auto it = w.powerUps.begin(); it != w.powerUps.end();) {
+        it->y -= 1.0f;
+        if (it->y < 0) {
+            it = w.powerUps.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // — Move enemy shots
+    updateShotsReference(w.shots);
+
+    // — Update explosions and particles
+    updateEffectsReference(w);
+
+    // — Collisions: bullets vs enemies
+    for (auto b = w.bullets.begin(); b != w.bullets.end();) {
+        bool hit = false;
+        for (auto e = w.enemies.begin(); e != w.enemies.end();) {
+            if (isColliding(*b, *e)) {
+                b = w.bullets.erase(b);
+
+                e->health--;
+                if (e->health <= 0) {
+                    // Create explosion
+                    playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+                    w.explosions.emplace_back(
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        30.0f + e->type * 10.0f
+                    );
+
+                    // Create particles
+                    createParticles(w,
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        10 + e->type * 5,
+                        1.0f, 0.5f, 0.0f
+                    );
+
+                    // Check for powerup drop
+                    spawnPowerUp(w, e->x, e->y);
+
+                    // Increase score based on enemy type
+                    w.score += 10 * (e->type + 1);
+                    w.enemiesDefeated++;
+
+                    // Level up check
+                    if (w.enemiesDefeated >= w.enemiesForNextLevel && w.level < MAX_LEVEL) {
+                        levelUp(w);
+                    }
+
+                    scriptEnemyGone(w, *e);
+                    e = w.enemies.erase(e);
+                }
+                else {
+                    scriptEnemyHit(w, *e);
+                    ++e;
+                }
+
+                hit = true;
+                break;
+            }
+            else {
+                ++e;
+            }
+        }
+        if (!hit) ++b;
+    }
+
+    // — Collisions: rockets vs enemies. Kills only zero the enemy's health;
+    // the dead are swept after the loop.
+    for (auto r = w.rockets.begin(); r != w.rockets.end();) {
+        int target = rocketBlastTargetReference(w, *r);
+        if (target < 0) {
+            ++r;
+            continue;
+        }
+        r = w.rockets.erase(r);
+        Enemy* e = &w.enemies[target];
+
+        // Create explosion
+        playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+        w.explosions.emplace_back(
+            e->x + e->width / 2,
+            e->y + e->height / 2,
+            50.0f
+        );
+
+        // Create particles
+        createParticles(w,
+            e->x + e->width / 2,
+            e->y + e->height / 2,
+            20,
+            1.0f, 0.3f, 0.0f
+        );
+
+        if (e->type == BOSS_TYPE && e->health > ROCKET_BOSS_DAMAGE) {
+            // Bosses soak rockets
+            e->health -= ROCKET_BOSS_DAMAGE;
+            scriptEnemyHit(w, *e);
+            continue;
+        }
+
+        // Check for powerup drop (higher chance from rockets)
+        if (worldRand(w) % (POWERUP_CHANCE / 2) == 0) {
+            spawnPowerUp(w, e->x, e->y);
+        }
+
+        // Rockets always destroy enemies regardless of health
+        w.score += 30 * (e->type + 1);
+        w.enemiesDefeated++;
+
+        // Level up check
+        if (w.enemiesDefeated >= w.enemiesForNextLevel && w.level < MAX_LEVEL) {
+            levelUp(w);
+        }
+
+        scriptEnemyGone(w, *e);
+        e->health = 0;
+    }
+    w.enemies.erase(std::remove_if(w.enemies.begin(), w.enemies.end(),
+        [](const Enemy& e) { return e.health <= 0; }), w.enemies.end());
+
+    // — Collisions: player vs enemies and powerups (team-wide lives and buffs)
+    for (int s = 0; s < w.players; s++) {
+        GameObject& ship = shipOf(w, s);
+        if (w.invulnerableTimer < 0) {
+            for (auto e = w.enemies.begin(); e != w.enemies.end();) {
+                if (isColliding(ship, *e)) {
+                    playSound(w, SOUND_EXPLOSION, e->x + e->width / 2);
+                    w.explosions.emplace_back(
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        40.0f,
+                        1.0f, 0.0f, 0.0f
+                    );
+
+                    createParticles(w,
+                        e->x + e->width / 2,
+                        e->y + e->height / 2,
+                        15,
+                        1.0f, 0.2f, 0.2f
+                    );
+
+                    // Bosses survive a ram; anything else is destroyed by it
+                    if (e->type == BOSS_TYPE) {
+                        ++e;
+                    }
+                    else {
+                        scriptEnemyGone(w, *e);
+                        e = w.enemies.erase(e);
+                    }
+
+                    if (damageShip(w, ship)) return;
+                }
+                else {
+                    ++e;
+                }
+            }
+        }
+
+        // — Collisions: player vs enemy shots (re-checked: a ram above may
+        // have started invulnerability)
+        if (w.invulnerableTimer < 0) {
+            int hit = findShotHitReference(w.shots, ship);
+            if (hit >= 0) {
+                createParticles(w, w.shots.x[hit], w.shots.y[hit], 10, 1.0f, 0.3f, 0.6f);
+                parkShot(w.shots, hit);
+                if (damageShip(w, ship)) return;
+            }
+        }
+
+        // — Collisions: player vs powerups
+        for (auto p = w.powerUps.begin(); p != w.powerUps.end();) {
+            if (isColliding(ship, *p)) {
+                addModifier(w, ModifierKind(p->type));
+                playSound(w, SOUND_POWERUP, p->x + p->width / 2);
+
+                // Create powerup pickup effect
+                createParticles(w,
+                    p->x + p->width / 2,
+                    p->y + p->height / 2,
+                    15,
+                    0.5f, 1.0f, 1.0f
+                );
+
+                p = w.powerUps.erase(p);
+            }
+            else {
+                ++p;
+            }
+        }
+    }
+
+    // — Player movement
+    float playerSpeed = 5.0f * speedFactor(w);
+    moveShip(w.player, in, playerSpeed);
+    if (w.players > 1) {
+        moveShip(w.player2, in2, playerSpeed);
+    }
+}
+
+void tickWorldReference(World& w, unsigned char bits1, unsigned char bits2 = 0) {
+    PlayerInput in = applyInputBits(w, 0, bits1);
+    PlayerInput in2;
+    if (w.players > 1) in2 = applyInputBits(w, 1, bits2);
+    stepWorldReference(w, in, in2);
+}
+
+// Where two worlds first differ, with both values as text.
+struct WorldDiff {
+    char where[64];
+    char a[40], b[40];
+};
+
+bool differs(float a, float b) {
+    return memcmp(&a, &b, sizeof a) != 0;   // tells -0 from 0 and compares NaNs
+}
+
+template <typename T>
+bool differs(const T& a, const T& b) {
+    return a != b;
+}
+
+void showValue(char* out, size_t n, float v) {
+    snprintf(out, n, "%.9g", v);
+}
+
+template <typename T>
+void showValue(char* out, size_t n, const T& v) {
+    snprintf(out, n, "%lld", (long long)v);
+}
+
+// Records the field if a and b differ. `list` and `i` name the owner:
+// "enemies", 3 gives "enemies[3].x"; an index below 0 leaves it out.
+template <typename T>
+bool diffField(WorldDiff& d, const char* list, int i, const char* field, const T& a, const T& b) {
+    if (!differs(a, b)) return false;
+    const char* dot = *list && *field ? "." : "";
+    if (i >= 0) snprintf(d.where, sizeof(d.where), "%s[%d]%s%s", list, i, dot, field);
+    else snprintf(d.where, sizeof(d.where), "%s%s%s", list, dot, field);
+    showValue(d.a, sizeof(d.a), a);
+    showValue(d.b, sizeof(d.b), b);
+    return true;
+}
+
+#define DIFF_FIELD(f) if (diffField(d, list, i, #f, a.f, b.f)) return true
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const GameObject& a, const GameObject& b) {
+    DIFF_FIELD(x);
+    DIFF_FIELD(y);
+    DIFF_FIELD(width);
+    DIFF_FIELD(height);
+    DIFF_FIELD(id);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const Bullet& a, const Bullet& b) {
+    if (diffEntity(d, list, i, static_cast<const GameObject&>(a), b)) return true;
+    DIFF_FIELD(angle);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const Enemy& a, const Enemy& b) {
+    if (diffEntity(d, list, i, static_cast<const GameObject&>(a), b)) return true;
+    DIFF_FIELD(health);
+    DIFF_FIELD(maxHealth);
+    DIFF_FIELD(type);
+    DIFF_FIELD(vx);
+    DIFF_FIELD(phase);
+    DIFF_FIELD(watched);
+    DIFF_FIELD(fireCooldown);
+    DIFF_FIELD(shotAngle);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const Rocket& a, const Rocket& b) {
+    if (diffEntity(d, list, i, static_cast<const GameObject&>(a), b)) return true;
+    DIFF_FIELD(spawnTime);
+    DIFF_FIELD(vx);
+    DIFF_FIELD(vy);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const PowerUp& a, const PowerUp& b) {
+    if (diffEntity(d, list, i, static_cast<const GameObject&>(a), b)) return true;
+    DIFF_FIELD(type);
+    DIFF_FIELD(spawnTime);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const Explosion& a, const Explosion& b) {
+    DIFF_FIELD(x);
+    DIFF_FIELD(y);
+    DIFF_FIELD(size);
+    DIFF_FIELD(alpha);
+    DIFF_FIELD(r);
+    DIFF_FIELD(g);
+    DIFF_FIELD(b);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const Particle& a, const Particle& b) {
+    DIFF_FIELD(x);
+    DIFF_FIELD(y);
+    DIFF_FIELD(vx);
+    DIFF_FIELD(vy);
+    DIFF_FIELD(lifetime);
+    DIFF_FIELD(maxLife);
+    DIFF_FIELD(size);
+    DIFF_FIELD(r);
+    DIFF_FIELD(g);
+    DIFF_FIELD(b);
+    DIFF_FIELD(alpha);
+    return false;
+}
+
+// Free timer nodes only keep their free-list link and generation.
+bool diffEntity(WorldDiff& d, const char* list, int i, const TimerNode& a, const TimerNode& b) {
+    DIFF_FIELD(slot);
+    DIFF_FIELD(next);
+    DIFF_FIELD(generation);
+    if (a.slot < 0) return false;
+    DIFF_FIELD(due);
+    DIFF_FIELD(prev);
+    DIFF_FIELD(event);
+    return false;
+}
+
+bool diffEntity(WorldDiff& d, const char* list, int i, const ActiveModifier& a, const ActiveModifier& b) {
+    DIFF_FIELD(live);
+    if (!a.live) return false;
+    DIFF_FIELD(expires);
+    DIFF_FIELD(magnitude);
+    DIFF_FIELD(kind);
+    return false;
+}
+
+#undef DIFF_FIELD
+
+template <typename T>
+bool diffList(WorldDiff& d, const char* list, const std::vector<T>& a, const std::vector<T>& b) {
+    if (diffField(d, list, -1, "size()", a.size(), b.size())) return true;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (diffEntity(d, list, int(i), a[i], b[i])) return true;
+    }
+    return false;
+}
+
+bool diffFloats(WorldDiff& d, const char* list, const std::vector<float>& a, const std::vector<float>& b) {
+    if (diffField(d, list, -1, "size()", a.size(), b.size())) return true;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (diffField(d, list, int(i), "", a[i], b[i])) return true;
+    }
+    return false;
+}
+
+// Everything the simulation owns, in stepping order. The spatial grids are
+// left out: they are scratch rebuilt from the lists each step, and the
+// reference never builds them.
+bool diffWorlds(const World& a, const World& b, WorldDiff& d) {
+    if (diffEntity(d, "player", -1, a.player, b.player)) return true;
+    if (diffEntity(d, "player2", -1, a.player2, b.player2)) return true;
+    if (diffField(d, "", -1, "players", a.players, b.players)) return true;
+    if (diffField(d, "", -1, "tick", a.tick, b.tick)) return true;
+    if (diffField(d, "", -1, "simTime", a.simTime, b.simTime)) return true;
+    if (diffField(d, "", -1, "rngState", a.rngState, b.rngState)) return true;
+    if (diffField(d, "", -1, "nextId", a.nextId, b.nextId)) return true;
+    if (diffField(d, "", -1, "score", a.score, b.score)) return true;
+    if (diffField(d, "", -1, "level", a.level, b.level)) return true;
+    if (diffField(d, "", -1, "lives", a.lives, b.lives)) return true;
+    if (diffField(d, "", -1, "enemiesDefeated", a.enemiesDefeated, b.enemiesDefeated)) return true;
+    if (diffField(d, "", -1, "enemiesForNextLevel", a.enemiesForNextLevel, b.enemiesForNextLevel)) return true;
+    if (diffField(d, "", -1, "gameOver", a.gameOver, b.gameOver)) return true;
+    if (diffList(d, "bullets", a.bullets, b.bullets)) return true;
+    if (diffList(d, "enemies", a.enemies, b.enemies)) return true;
+    if (diffList(d, "rockets", a.rockets, b.rockets)) return true;
+    if (diffList(d, "powerUps", a.powerUps, b.powerUps)) return true;
+    if (diffFloats(d, "shots.x", a.shots.x, b.shots.x)) return true;
+    if (diffFloats(d, "shots.y", a.shots.y, b.shots.y)) return true;
+    if (diffFloats(d, "shots.vx", a.shots.vx, b.shots.vx)) return true;
+    if (diffFloats(d, "shots.vy", a.shots.vy, b.shots.vy)) return true;
+    if (diffList(d, "explosions", a.explosions, b.explosions)) return true;
+    if (diffList(d, "particles", a.particles, b.particles)) return true;
+
+    const TimerWheel& ta = a.timers;
+    const TimerWheel& tb = b.timers;
+    if (diffField(d, "timers", -1, "now", ta.now, tb.now)) return true;
+    if (diffField(d, "timers", -1, "freeHead", ta.freeHead, tb.freeHead)) return true;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+        if (diffField(d, "timers.heads", i, "", ta.heads[i], tb.heads[i])) return true;
+    }
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (diffEntity(d, "timers.nodes", i, ta.nodes[i], tb.nodes[i])) return true;
+    }
+    if (diffField(d, "", -1, "spawnTimer", a.spawnTimer, b.spawnTimer)) return true;
+    if (diffField(d, "", -1, "invulnerableTimer", a.invulnerableTimer, b.invulnerableTimer)) return true;
+
+    const ModifierSet& ma = a.modifiers;
+    const ModifierSet& mb = b.modifiers;
+    if (diffField(d, "modifiers", -1, "heapSize", ma.heapSize, mb.heapSize)) return true;
+    for (int i = 0; i < ma.heapSize; i++) {
+        if (diffField(d, "modifiers.heap", i, "", ma.heap[i], mb.heap[i])) return true;
+    }
+    for (int i = 0; i < MAX_MODIFIERS; i++) {
+        if (diffEntity(d, "modifiers.slots", i, ma.slots[i], mb.slots[i])) return true;
+    }
+    for (int k = 0; k < MOD_KIND_COUNT; k++) {
+        if (diffField(d, "modifiers.stacks", k, "", ma.stacks[k], mb.stacks[k])) return true;
+        if (diffField(d, "modifiers.magnitude", k, "", ma.magnitude[k], mb.magnitude[k])) return true;
+    }
+
+    if (diffField(d, "messageLog", -1, "count", a.messageLog.count, b.messageLog.count)) return true;
+    for (int i = 0; i < a.messageLog.count; i++) {
+        const char* la = a.messageLog.lines[i];
+        const char* lb = b.messageLog.lines[i];
+        if (strcmp(la, lb)) {
+            snprintf(d.where, sizeof(d.where), "messageLog.lines[%d]", i);
+            snprintf(d.a, sizeof(d.a), "%s", la);
+            snprintf(d.b, sizeof(d.b), "%s", lb);
+            return true;
+        }
+    }
+    if (diffField(d, "sounds", -1, "count", a.sounds.count, b.sounds.count)) return true;
+    for (int i = 0; i < a.sounds.count; i++) {
+        if (diffField(d, "sounds.cues", i, "sound", a.sounds.cues[i].sound, b.sounds.cues[i].sound)) return true;
+        if (diffField(d, "sounds.cues", i, "x", a.sounds.cues[i].x, b.sounds.cues[i].x)) return true;
+    }
+
+    // Scripts live outside the world; their counters show a wave running
+    // differently before it touches the world
+    if (diffField(d, "", -1, "director", a.director != nullptr, b.director != nullptr)) return true;
+    if (a.director) {
+        const ScriptDirector& sa = *a.director;
+        const ScriptDirector& sb = *b.director;
+        if (diffField(d, "director", -1, "cleared", sa.cleared, sb.cleared)) return true;
+        if (diffField(d, "director", -1, "seq", sa.seq, sb.seq)) return true;
+        if (diffField(d, "director", -1, "bossId", sa.bossId, sb.bossId)) return true;
+        if (diffField(d, "director", -1, "resumes", sa.resumes, sb.resumes)) return true;
+    }
+    return false;
+}
+
+// Recorded sessions (--record-inputs): "SSIN", a version byte, the world
+// seed as 4 little-endian bytes, then one byte of INPUT_* bits per local
+// tick. Replaying the bits into World(seed) with a director attached
+// reproduces the session.
+const int INPUT_LOG_VERSION = 1;
+
+FILE* openInputLog(const char* path, unsigned int seed) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror("record-inputs");
+        return nullptr;
+    }
+    fwrite("SSIN", 1, 4, f);
+    fputc(INPUT_LOG_VERSION, f);
+    for (int i = 0; i < 4; i++) fputc((seed >> (8 * i)) & 0xff, f);
+    return f;
+}
+
+void closeInputLog() {
+    if (inputLog) {
+        fclose(inputLog);
+        inputLog = nullptr;
+    }
+}
+
+bool loadInputLog(const char* path, unsigned int& seed, std::vector<unsigned char>& bits) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    unsigned char header[9];
+    bool ok = fread(header, 1, sizeof(header), f) == sizeof(header) &&
+        !memcmp(header, "SSIN", 4) && header[4] == INPUT_LOG_VERSION;
+    if (ok) {
+        seed = header[5] | header[6] << 8 | header[7] << 16 | unsigned(header[8]) << 24;
+        bits.clear();
+        for (int c; (c = fgetc(f)) != EOF;) bits.push_back((unsigned char)c);
+    }
+    else {
+        fprintf(stderr, "%s: not an input log\n", path);
+    }
+    fclose(f);
+    return ok;
+}
+
+struct DiffSession {
+    char label[80];
+    unsigned int seed;   // world seed as passed to World()
+    bool coop;           // two bot ships and the timer spawner, as in netplay
+    bool dense;          // shots topped up to bullet-hell density, lives never run out
+    std::vector<unsigned char> inputs;   // recorded bits; empty for bot-driven
+};
+
+struct DiffTotals {
+    long long ticks;
+    double referenceUs, optimizedUs;
+    int diverged;
+};
+
+// Steps a reference and an optimized world through one session and checks
+// them after every tick. False on the first divergence.
+bool runDiffSession(const DiffSession& s, int maxTicks, DiffTotals& totals) {
+    ScriptDirector refScripts, optScripts;
+    World ref(s.seed), opt(s.seed);
+    reserveWorld(ref);
+    reserveWorld(opt);
+    if (s.coop) {
+        for (World* w : { &ref, &opt }) {
+            w->players = 2;
+            w->player.x = windowWidth / 3 - 25;
+        }
+    }
+    else {
+        attachDirector(ref, refScripts);
+        attachDirector(opt, optScripts);
+    }
+    if (s.dense) ref.lives = opt.lives = 1 << 30;
+
+    Bot bot, bot2;
+    unsigned int noise = mixSeed(s.seed ^ 0x5eedu);
+    int ticks = s.inputs.empty() ? maxTicks : int(s.inputs.size());
+    for (int t = 0; t < ticks; t++) {
+        // Bots see the optimized world; the two are identical up to here
+        unsigned char bits1, bits2 = 0;
+        if (!s.inputs.empty()) {
+            bits1 = s.inputs[t];
+        }
+        else {
+            bits1 = botThink(opt, bot);
+            if (s.coop) bits2 = botThink(opt, bot2, 1);
+            // Now and then mash random keys instead, for moves no bot makes
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            if (noise % 4 == 0) bits1 = (unsigned char)(noise >> 8) & ~INPUT_RESTART;
+            if (s.coop && noise % 4 == 1) bits2 = (unsigned char)(noise >> 16) & ~INPUT_RESTART;
+        }
+        if (s.dense) {
+            for (World* w : { &ref, &opt }) {
+                while (w->shots.size() < 400) {
+                    float x = float(worldRand(*w) % windowWidth);
+                    float y = float(windowHeight / 2 + worldRand(*w) % (windowHeight / 2));
+                    emitRadial(w->shots, x, y, 32, 1.0f + (worldRand(*w) % 100) * 0.01f,
+                        (worldRand(*w) % 628) * 0.01f);
+                }
+            }
+        }
+
+        // Swap which runs first every tick so neither always gets the warm
+        // cache the other left behind
+        using Micros = std::chrono::duration<double, std::micro>;
+        auto timed = [](auto&& step) {
+            auto start = std::chrono::steady_clock::now();
+            step();
+            return Micros(std::chrono::steady_clock::now() - start).count();
+        };
+        auto stepRef = [&] { tickWorldReference(ref, bits1, bits2); };
+        auto stepOpt = [&] { tickWorld(opt, bits1, bits2); };
+        if (t % 2 == 0) {
+            totals.referenceUs += timed(stepRef);
+            totals.optimizedUs += timed(stepOpt);
+        }
+        else {
+            totals.optimizedUs += timed(stepOpt);
+            totals.referenceUs += timed(stepRef);
+        }
+        totals.ticks++;
+        ref.sounds.count = opt.sounds.count = 0;   // nobody drains them here
+
+        WorldDiff d;
+        if (diffWorlds(ref, opt, d)) {
+            printf("DIVERGED  %s, tick %d (world tick %u), input %02x/%02x:\n"
+                "          %s: reference %s, optimized %s\n",
+                s.label, t + 1, ref.tick, bits1, bits2, d.where, d.a, d.b);
+            totals.diverged++;
+            return false;
+        }
+    }
+    return true;
+}
+
+// --diff-test: `sessions` seeded bot sessions (every second one dense, every
+// third co-op) plus each recorded input log. Exits non-zero on any divergence.
+int runDiffTest(int sessions, unsigned int seed, int maxTicks, const std::vector<const char*>& logs) {
+    std::vector<DiffSession> plan;
+    for (int i = 0; i < sessions; i++) {
+        DiffSession s;
+        s.seed = mixSeed(seed + i);
+        s.dense = i % 2 == 1;
+        s.coop = i % 3 == 2;
+        snprintf(s.label, sizeof(s.label), "seed %u%s%s", seed + i,
+            s.coop ? " co-op" : "", s.dense ? " dense" : "");
+        plan.push_back(s);
+    }
+    for (const char* path : logs) {
+        DiffSession s;
+        s.dense = s.coop = false;
+        if (!loadInputLog(path, s.seed, s.inputs)) return 1;
+        snprintf(s.label, sizeof(s.label), "%s", path);
+        plan.push_back(s);
+    }
+
+    printf("Diff test: %d seeded sessions (seed %u, up to %d ticks), %zu recorded\n",
+        sessions, seed, maxTicks, logs.size());
+    DiffTotals totals = { 0, 0.0, 0.0, 0 };
+    for (const auto& s : plan) runDiffSession(s, maxTicks, totals);
+
+    double ticks = double(std::max(totals.ticks, 1LL));
+    printf("Stepped %lld ticks: reference %.1f us/tick, optimized %.1f us/tick\n",
+        totals.ticks, totals.referenceUs / ticks, totals.optimizedUs / ticks);
+    printf("%s: %d of %zu sessions diverged\n", totals.diverged ? "FAIL" : "PASS",
+        totals.diverged, plan.size());
+    return totals.diverged ? 1 : 0;
+}
+
+// ───────────────────── State Streaming ─────────────────────
+// Compact per-frame world deltas for spectators and session archives
+// (--record), played back by the viewer (--replay). The game thread only
+// copies a quantized capture into a preallocated ring; sorting, diffing,
+// varint/zigzag encoding and file I/O all happen on the writer thread, and a
+// full ring drops the frame rather than stalling the game.
+//
+// Stream: "SSTR" u8 version, then per frame [varint length][body]:
+//   varint type (0 delta, 1 keyframe), varint frames since previous,
+//   varint HUD change mask, zigzag delta per changed HUD field,
+//   keyframe: varint n, n x (varint id gap, u8 kind, zz x, zz y, varint aux)
+//   delta:    varint n despawned ids (as id gaps), varint n spawns (as above),
+//             varint n moves, n x (varint skip*2|auxChanged, zz rx, zz ry, [varint aux])
+//             where r is the position minus its prediction (last position
+//             plus last step); survivors not listed moved exactly as predicted
+//   varint n explosions, n x (zz x, zz y, varint size, u8 r, u8 g, u8 b)
+//   enemy shots, in list order as zz x, zz y, zz vx, zz vy in fixed point:
+//   keyframe: varint n, n shots
+//   delta:    varint steps, varint n removed, n x varint index gap, varint
+//             n new shots; survivors keep their order and fly `steps` steps
+//             straight, and new shots are appended, as in updateShots
+const int STREAM_VERSION = 3;
+const int STREAM_KEYFRAME_INTERVAL = 300;   // about 5 s
+const int STREAM_RING = 16;
+const float STREAM_SHOT_POS = 16.0f;     // shot positions in 1/16 px
+const float STREAM_SHOT_VEL = 1024.0f;   // shot velocities in 1/1024 px per step
+const int STREAM_HEADINGS = 256;         // rocket headings per turn
+
+enum StreamKind { SK_SHIP, SK_ENEMY, SK_BULLET, SK_ROCKET, SK_POWERUP };
+
+enum HudField {
+    HUD_SCORE, HUD_LIVES, HUD_LEVEL, HUD_DEFEATED, HUD_NEXT_LEVEL, HUD_GAMEOVER,
+    HUD_PLAYERS, HUD_SHIELD, HUD_MULTISHOT, HUD_SPEED_BOOST, HUD_SHIELD_SECS,
+    HUD_MULTISHOT_SECS, HUD_SPEED_SECS, HUD_INVULNERABLE, HUD_COUNT
+};
+
+struct StreamEntity {
+    unsigned int id;
+    unsigned char kind;
+    int x, y;
+    unsigned int aux;   // enemy: type | health << 2, rocket: heading, power-up: type
+    int vx, vy;         // last step, the prediction state shared with the decoder
+};
+
+struct StreamBurst {
+    int x, y, size;
+    unsigned char r, g, b;
+};
+
+struct StreamFrame {
+    unsigned int frame;
+    unsigned int tick;                    // world tick, so shots advance only when it steps
+    int hud[HUD_COUNT];
+    std::vector<StreamEntity> entities;   // sorted by id once encoded
+    std::vector<StreamBurst> bursts;      // explosions spawned this frame
+    EnemyShots shots;                     // live shots; fixed-point exact once decoded
+};
+
+void putVarint(std::vector<unsigned char>& out, unsigned int v) {
+    while (v >= 0x80) {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+unsigned int zigzag(int v) {
+    return (unsigned(v) << 1) ^ unsigned(v >> 31);
+}
+
+int unzigzag(unsigned int v) {
+    return int(v >> 1) ^ -int(v & 1);
+}
+
+struct StreamCursor {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok;
+};
+
+unsigned int getVarint(StreamCursor& c) {
+    unsigned int v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (c.p >= c.end) {
+            c.ok = false;
+            return 0;
+        }
+        unsigned char b = *c.p++;
+        v |= unsigned(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    c.ok = false;
+    return v;
+}
+
+unsigned char getByte(StreamCursor& c) {
+    if (c.p >= c.end) {
+        c.ok = false;
+        return 0;
+    }
+    return *c.p++;
+}
+
+void addStreamEntity(StreamFrame& f, const GameObject& o, unsigned char kind, unsigned int aux) {
+    StreamEntity e;
+    e.id = o.id;
+    e.kind = kind;
+    e.x = int(std::floor(o.x));
+    e.y = int(std::floor(o.y));
+    e.aux = aux;
+    e.vx = e.vy = 0;
+    f.entities.push_back(e);
+}
+
+// Game-thread side: quantize the world into `f`. Reuses f's capacity.
+void captureStreamFrame(const World& w, StreamFrame& f) {
+    f.hud[HUD_SCORE] = w.score;
+    f.hud[HUD_LIVES] = w.lives;
+    f.hud[HUD_LEVEL] = w.level;
+    f.hud[HUD_DEFEATED] = w.enemiesDefeated;
+    f.hud[HUD_NEXT_LEVEL] = w.enemiesForNextLevel;
+    f.hud[HUD_GAMEOVER] = w.gameOver;
+    f.hud[HUD_PLAYERS] = w.players;
+    f.hud[HUD_SHIELD] = modifierStacks(w, MOD_SHIELD);
+    f.hud[HUD_MULTISHOT] = modifierStacks(w, MOD_MULTI_SHOT);
+    f.hud[HUD_SPEED_BOOST] = modifierStacks(w, MOD_SPEED_BOOST);
+    f.hud[HUD_SHIELD_SECS] = int(modifierSeconds(w, MOD_SHIELD));
+    f.hud[HUD_MULTISHOT_SECS] = int(modifierSeconds(w, MOD_MULTI_SHOT));
+    f.hud[HUD_SPEED_SECS] = int(modifierSeconds(w, MOD_SPEED_BOOST));
+    f.hud[HUD_INVULNERABLE] = int(timerSeconds(w, w.invulnerableTimer) * 10);
+
+    f.tick = w.tick;
+    f.entities.clear();
+    for (int i = 0; i < w.players; i++) addStreamEntity(f, shipOf(w, i), SK_SHIP, 0);
+    for (const auto& e : w.enemies) addStreamEntity(f, e, SK_ENEMY, e.type | (e.health << 2));
+    for (const auto& b : w.bullets) addStreamEntity(f, b, SK_BULLET, 0);
+    for (const auto& r : w.rockets) {
+        float turns = std::atan2(r.vy, r.vx) / 6.2831853f;
+        addStreamEntity(f, r, SK_ROCKET, unsigned(std::lround(turns * STREAM_HEADINGS)) % STREAM_HEADINGS);
+    }
+    for (const auto& p : w.powerUps) addStreamEntity(f, p, SK_POWERUP, p.type);
+
+    // Explosions are spawned at full alpha and fade every step after that
+    f.bursts.clear();
+    for (const auto& e : w.explosions) {
+        if (e.alpha < 1.0f) continue;
+        StreamBurst b = { int(e.x), int(e.y), int(e.size),
+            (unsigned char)(e.r * 255), (unsigned char)(e.g * 255), (unsigned char)(e.b * 255) };
+        f.bursts.push_back(b);
+    }
+
+    clearShots(f.shots);
+    for (size_t i = 0; i < w.shots.size(); i++) {
+        if (w.shots.y[i] == SHOT_PARKED) continue;   // spent; culled next step
+        addShot(f.shots, w.shots.x[i], w.shots.y[i], w.shots.vx[i], w.shots.vy[i]);
+    }
+}
+
+bool entityIdLess(const StreamEntity& a, const StreamEntity& b) {
+    return a.id < b.id;
+}
+
+void putStreamEntity(std::vector<unsigned char>& out, const StreamEntity& e, unsigned int& lastId) {
+    putVarint(out, e.id - lastId);
+    lastId = e.id;
+    out.push_back(e.kind);
+    putVarint(out, zigzag(e.x));
+    putVarint(out, zigzag(e.y));
+    putVarint(out, e.aux);
+}
+
+StreamEntity getStreamEntity(StreamCursor& c, unsigned int& lastId) {
+    StreamEntity e;
+    lastId += getVarint(c);
+    e.id = lastId;
+    e.kind = getByte(c);
+    e.x = unzigzag(getVarint(c));
+    e.y = unzigzag(getVarint(c));
+    e.aux = getVarint(c);
+    e.vx = e.vy = 0;
+    return e;
+}
+
+void putStreamShot(std::vector<unsigned char>& out, const EnemyShots& s, size_t i) {
+    putVarint(out, zigzag(int(std::lround(s.x[i] * STREAM_SHOT_POS))));
+    putVarint(out, zigzag(int(std::lround(s.y[i] * STREAM_SHOT_POS))));
+    putVarint(out, zigzag(int(std::lround(s.vx[i] * STREAM_SHOT_VEL))));
+    putVarint(out, zigzag(int(std::lround(s.vy[i] * STREAM_SHOT_VEL))));
+}
+
+void getStreamShot(StreamCursor& c, EnemyShots& s) {
+    float x = unzigzag(getVarint(c)) / STREAM_SHOT_POS;
+    float y = unzigzag(getVarint(c)) / STREAM_SHOT_POS;
+    float vx = unzigzag(getVarint(c)) / STREAM_SHOT_VEL;
+    float vy = unzigzag(getVarint(c)) / STREAM_SHOT_VEL;
+    addShot(s, x, y, vx, vy);
+}
+
+// The step's shot integration, `steps` times over.
+void advanceStreamShots(EnemyShots& s, unsigned int steps) {
+    for (size_t i = 0; i < s.size(); i++) {
+        for (unsigned int k = 0; k < steps; k++) {
+            s.x[i] += s.vx[i];
+            s.y[i] += s.vy[i];
+        }
+    }
+}
+
+// Shared by the encoder and decoder: the last reconstructed frame. The
+// encoder keeps its shots exact, to match them against the next capture.
+struct StreamState {
+    std::vector<StreamEntity> prev;
+    EnemyShots shots;
+    std::vector<unsigned int> shotGaps;   // encoder scratch
+    int hud[HUD_COUNT];
+    unsigned int frame, tick;
+    int sinceKeyframe;
+    bool started;
+    StreamState() : hud(), frame(0), tick(0), sinceKeyframe(0), started(false) {}
+};
+
+// Writer-thread side: append the encoded body of `cur` (entities get sorted
+// and their prediction state filled in) and make it the new reference.
+void encodeStreamFrame(StreamState& st, StreamFrame& cur, std::vector<unsigned char>& out) {
+    std::sort(cur.entities.begin(), cur.entities.end(), entityIdLess);
+    bool key = !st.started || st.sinceKeyframe >= STREAM_KEYFRAME_INTERVAL;
+    putVarint(out, key ? 1 : 0);
+    putVarint(out, cur.frame - st.frame);
+
+    unsigned int mask = 0;
+    for (int i = 0; i < HUD_COUNT; i++) {
+        if (key ? cur.hud[i] != 0 : cur.hud[i] != st.hud[i]) mask |= 1u << i;
+    }
+    putVarint(out, mask);
+    for (int i = 0; i < HUD_COUNT; i++) {
+        if (mask & (1u << i)) putVarint(out, zigzag(cur.hud[i] - (key ? 0 : st.hud[i])));
+    }
+
+    std::vector<StreamEntity>& ents = cur.entities;
+    if (key) {
+        unsigned int lastId = 0;
+        putVarint(out, unsigned(ents.size()));
+        for (const auto& e : ents) putStreamEntity(out, e, lastId);
+        st.sinceKeyframe = 0;
+    }
+    else {
+        // Merge the id-sorted lists once to count, then emit each section
+        const std::vector<StreamEntity>& prev = st.prev;
+        unsigned int despawns = 0, spawns = 0, moves = 0;
+        for (size_t i = 0, j = 0; i < prev.size() || j < ents.size();) {
+            if (j == ents.size() || (i < prev.size() && prev[i].id < ents[j].id)) {
+                despawns++;
+                i++;
+            }
+            else if (i == prev.size() || ents[j].id < prev[i].id) {
+                spawns++;
+                j++;
+            }
+            else {
+                StreamEntity& e = ents[j];
+                e.vx = e.x - prev[i].x;
+                e.vy = e.y - prev[i].y;
+                if (e.vx != prev[i].vx || e.vy != prev[i].vy || e.aux != prev[i].aux) moves++;
+                i++;
+                j++;
+            }
+        }
+
+        unsigned int lastId = 0;
+        putVarint(out, despawns);
+        for (size_t i = 0, j = 0; i < prev.size(); i++) {
+            while (j < ents.size() && ents[j].id < prev[i].id) j++;
+            if (j == ents.size() || ents[j].id != prev[i].id) {
+                putVarint(out, prev[i].id - lastId);
+                lastId = prev[i].id;
+            }
+        }
+
+        lastId = 0;
+        putVarint(out, spawns);
+        for (size_t i = 0, j = 0; j < ents.size(); j++) {
+            while (i < prev.size() && prev[i].id < ents[j].id) i++;
+            if (i == prev.size() || prev[i].id != ents[j].id) putStreamEntity(out, ents[j], lastId);
+        }
+
+        putVarint(out, moves);
+        unsigned int skip = 0;
+        for (size_t i = 0, j = 0; j < ents.size(); j++) {
+            while (i < prev.size() && prev[i].id < ents[j].id) i++;
+            if (i == prev.size() || prev[i].id != ents[j].id) continue;
+            const StreamEntity& p = prev[i];
+            const StreamEntity& e = ents[j];
+            bool auxChanged = e.aux != p.aux;
+            if (e.vx == p.vx && e.vy == p.vy && !auxChanged) {
+                skip++;
+                continue;
+            }
+            putVarint(out, skip * 2 + auxChanged);
+            putVarint(out, zigzag(e.vx - p.vx));
+            putVarint(out, zigzag(e.vy - p.vy));
+            if (auxChanged) putVarint(out, e.aux);
+            skip = 0;
+        }
+        st.sinceKeyframe++;
+    }
+
+    putVarint(out, unsigned(cur.bursts.size()));
+    for (const auto& b : cur.bursts) {
+        putVarint(out, zigzag(b.x));
+        putVarint(out, zigzag(b.y));
+        putVarint(out, unsigned(b.size));
+        out.push_back(b.r);
+        out.push_back(b.g);
+        out.push_back(b.b);
+    }
+
+    const EnemyShots& shots = cur.shots;
+    if (key) {
+        putVarint(out, unsigned(shots.size()));
+        for (size_t i = 0; i < shots.size(); i++) putStreamShot(out, shots, i);
+    }
+    else {
+        // Walk the previous shots forward; the first one that doesn't land
+        // exactly on the next capture was removed. A long gap or a restart
+        // just resends them all.
+        unsigned int steps = cur.tick - st.tick;
+        if (cur.tick < st.tick || steps > unsigned(STREAM_KEYFRAME_INTERVAL)) steps = 0;
+        EnemyShots& prev = st.shots;
+        advanceStreamShots(prev, steps);
+        st.shotGaps.clear();
+        size_t j = 0, after = 0;
+        for (size_t i = 0; i < prev.size(); i++) {
+            if (j < shots.size() && prev.x[i] == shots.x[j] && prev.y[i] == shots.y[j] &&
+                prev.vx[i] == shots.vx[j] && prev.vy[i] == shots.vy[j]) {
+                j++;
+                continue;
+            }
+            st.shotGaps.push_back(unsigned(i - after));
+            after = i + 1;
+        }
+        putVarint(out, steps);
+        putVarint(out, unsigned(st.shotGaps.size()));
+        for (unsigned int gap : st.shotGaps) putVarint(out, gap);
+        putVarint(out, unsigned(shots.size() - j));
+        for (; j < shots.size(); j++) putStreamShot(out, shots, j);
+    }
+
+    memcpy(st.hud, cur.hud, sizeof(st.hud));
+    st.frame = cur.frame;
+    st.tick = cur.tick;
+    st.started = true;
+    st.prev.swap(ents);
+    std::swap(st.shots, cur.shots);
+}
+
+// Viewer side: rebuild the next frame into `cur` from one encoded body.
+bool decodeStreamFrame(StreamState& st, StreamCursor& c, StreamFrame& cur) {
+    bool key = getVarint(c) == 1;
+    if (!key && !st.started) return false;   // joined mid-stream: wait for a keyframe
+    cur.frame = st.frame + getVarint(c);
+
+    unsigned int mask = getVarint(c);
+    for (int i = 0; i < HUD_COUNT; i++) {
+        int base = key ? 0 : st.hud[i];
+        cur.hud[i] = (mask & (1u << i)) ? base + unzigzag(getVarint(c)) : base;
+    }
+
+    cur.entities.clear();
+    unsigned int lastId = 0;
+    if (key) {
+        unsigned int n = getVarint(c);
+        for (unsigned int i = 0; i < n && c.ok; i++) cur.entities.push_back(getStreamEntity(c, lastId));
+    }
+    else {
+        // Survivors: previous entities minus the despawned ids
+        std::vector<StreamEntity>& prev = st.prev;
+        unsigned int despawns = getVarint(c);
+        size_t i = 0;
+        for (unsigned int d = 0; d < despawns && c.ok; d++) {
+            lastId += getVarint(c);
+            while (i < prev.size() && prev[i].id < lastId) cur.entities.push_back(prev[i++]);
+            if (i < prev.size() && prev[i].id == lastId) i++;
+        }
+        while (i < prev.size()) cur.entities.push_back(prev[i++]);
+
+        // Spawns are read now but merged in after the moves, which index survivors
+        size_t survivors = cur.entities.size();
+        unsigned int spawns = getVarint(c);
+        lastId = 0;
+        for (unsigned int s = 0; s < spawns && c.ok; s++) cur.entities.push_back(getStreamEntity(c, lastId));
+
+        unsigned int moves = getVarint(c);
+        size_t k = 0;
+        for (unsigned int m = 0; m < moves && c.ok; m++) {
+            unsigned int head = getVarint(c);
+            k += head >> 1;
+            if (k >= survivors) {
+                c.ok = false;
+                break;
+            }
+            StreamEntity& e = cur.entities[k++];
+            e.vx += unzigzag(getVarint(c));
+            e.vy += unzigzag(getVarint(c));
+            if (head & 1) e.aux = getVarint(c);
+        }
+        for (size_t s = 0; s < survivors; s++) {
+            cur.entities[s].x += cur.entities[s].vx;
+            cur.entities[s].y += cur.entities[s].vy;
+        }
+        std::inplace_merge(cur.entities.begin(), cur.entities.begin() + survivors,
+            cur.entities.end(), entityIdLess);
+    }
+
+    cur.bursts.clear();
+    unsigned int bursts = getVarint(c);
+    for (unsigned int i = 0; i < bursts && c.ok; i++) {
+        StreamBurst b;
+        b.x = unzigzag(getVarint(c));
+        b.y = unzigzag(getVarint(c));
+        b.size = int(getVarint(c));
+        b.r = getByte(c);
+        b.g = getByte(c);
+        b.b = getByte(c);
+        cur.bursts.push_back(b);
+    }
+
+    clearShots(cur.shots);
+    if (key) {
+        unsigned int n = getVarint(c);
+        for (unsigned int i = 0; i < n && c.ok; i++) getStreamShot(c, cur.shots);
+    }
+    else {
+        const EnemyShots& prev = st.shots;
+        unsigned int steps = getVarint(c);
+        if (steps > unsigned(STREAM_KEYFRAME_INTERVAL)) c.ok = false;
+        unsigned int removed = getVarint(c);
+        size_t i = 0;
+        for (unsigned int r = 0; r < removed && c.ok; r++) {
+            size_t at = i + getVarint(c);
+            if (at >= prev.size()) {
+                c.ok = false;
+                break;
+            }
+            for (; i < at; i++) addShot(cur.shots, prev.x[i], prev.y[i], prev.vx[i], prev.vy[i]);
+            i = at + 1;
+        }
+        for (; i < prev.size(); i++) addShot(cur.shots, prev.x[i], prev.y[i], prev.vx[i], prev.vy[i]);
+        if (c.ok) advanceStreamShots(cur.shots, steps);
+        unsigned int spawns = getVarint(c);
+        for (unsigned int k = 0; k < spawns && c.ok; k++) getStreamShot(c, cur.shots);
+    }
+    if (!c.ok) return false;
+
+    memcpy(st.hud, cur.hud, sizeof(st.hud));
+    st.frame = cur.frame;
+    st.started = true;
+    st.prev = cur.entities;
+    st.shots = cur.shots;
+    return true;
+}
+
+struct StreamWriter {
+    FILE* file;
+    StreamFrame ring[STREAM_RING];
+    std::atomic<unsigned int> head;   // next slot the game thread fills
+    std::atomic<unsigned int> tail;   // next slot the writer encodes
+    std::atomic<bool> quit;
+    std::mutex m;
+    std::condition_variable wake;
+    std::thread thread;
+
+    // Game-thread stats
+    unsigned int frame;
+    long long dropped;
+    // Writer-thread state
+    StreamState state;
+    std::vector<unsigned char> body, frameBytes;
+    long long bytes, encoded;
+    double encodeSeconds;
+
+    StreamWriter()
+        : file(nullptr), head(0), tail(0), quit(false), frame(0), dropped(0),
+        bytes(0), encoded(0), encodeSeconds(0) {
+    }
+};
+
+void streamWriterLoop(StreamWriter* s) {
+    TRACE_THREAD("stream writer");
+    ALLOC_SCOPE(ALLOC_STREAM);
+    for (;;) {
+        unsigned int t = s->tail.load(std::memory_order_relaxed);
+        if (t == s->head.load(std::memory_order_acquire)) {
+            if (s->quit) break;
+            std::unique_lock<std::mutex> lock(s->m);
+            s->wake.wait_for(lock, std::chrono::milliseconds(5));
+            continue;
+        }
+        TRACE_SCOPE("encode frame");
+        auto start = std::chrono::steady_clock::now();
+        s->body.clear();
+        encodeStreamFrame(s->state, s->ring[t % STREAM_RING], s->body);
+        s->frameBytes.clear();
+        putVarint(s->frameBytes, unsigned(s->body.size()));
+        s->frameBytes.insert(s->frameBytes.end(), s->body.begin(), s->body.end());
+        fwrite(s->frameBytes.data(), 1, s->frameBytes.size(), s->file);
+        s->bytes += s->frameBytes.size();
+        s->encoded++;
+        s->encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        s->tail.store(t + 1, std::memory_order_release);
+        endAllocFrame();
+    }
+    mergeAllocStats();
+}
+
+StreamWriter* openStreamWriter(const char* path) {
+    FILE* f = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+    if (!f) {
+        perror("record");
+        return nullptr;
+    }
+    fwrite("SSTR", 1, 4, f);
+    fputc(STREAM_VERSION, f);
+    StreamWriter* s = new StreamWriter();
+    s->file = f;
+    for (auto& slot : s->ring) {
+        slot.entities.reserve(256);
+        reserveShots(slot.shots, POOL_SHOTS);
+    }
+    reserveShots(s->state.shots, POOL_SHOTS);
+    s->thread = std::thread(streamWriterLoop, s);
+    return s;
+}
+
+// Called by the game thread once per frame; never waits on the writer.
+void recordStreamFrame(StreamWriter& s, const World& w) {
+    ALLOC_SCOPE(ALLOC_STREAM);
+    unsigned int h = s.head.load(std::memory_order_relaxed);
+    s.frame++;
+    if (h - s.tail.load(std::memory_order_acquire) >= unsigned(STREAM_RING)) {
+        s.dropped++;
+        return;
+    }
+    StreamFrame& slot = s.ring[h % STREAM_RING];
+    captureStreamFrame(w, slot);
+    slot.frame = s.frame;
+    s.head.store(h + 1, std::memory_order_release);
+    s.wake.notify_one();
+}
+
+void closeStreamWriter(StreamWriter* s) {
+    s->quit = true;
+    s->wake.notify_one();
+    s->thread.join();
+    fflush(s->file);
+    if (s->file != stdout) fclose(s->file);
+    double secs = s->encoded * TICK_SECONDS;
+    fprintf(stderr, "Recorded %lld frames (%lld dropped), %lld bytes, %.2f KB/s, %.1f us/frame encode\n",
+        s->encoded, s->dropped, s->bytes, secs > 0 ? s->bytes / secs / 1024.0 : 0.0,
+        s->encoded ? s->encodeSeconds * 1e6 / s->encoded : 0.0);
+    delete s;
+}
+
+struct StreamReader {
+    FILE* file;
+    StreamState state;
+    StreamFrame frame;
+    std::vector<unsigned char> body;
+    bool paused;
+    bool ended;
+};
+
+StreamReader* openStreamReader(const char* path) {
+    FILE* f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    char magic[5] = { 0 };
+    if (!f || fread(magic, 1, 5, f) != 5 || memcmp(magic, "SSTR", 4) || magic[4] != STREAM_VERSION) {
+        fprintf(stderr, "replay: %s is not a version %d stream\n", path, STREAM_VERSION);
+        return nullptr;
+    }
+    StreamReader* r = new StreamReader();
+    r->file = f;
+    r->paused = false;
+    r->ended = false;
+    return r;
+}
+
+// Reads frames until one decodes; false at end of stream.
+bool readStreamFrame(StreamReader& r) {
+    for (;;) {
+        unsigned int len = 0;
+        int shift = 0, ch;
+        do {
+            ch = fgetc(r.file);
+            if (ch == EOF) return false;
+            len |= unsigned(ch & 0x7f) << shift;
+            shift += 7;
+        } while ((ch & 0x80) && shift < 35);
+        r.body.resize(len);
+        if (len && fread(r.body.data(), 1, len, r.file) != len) return false;
+        StreamCursor c = { r.body.data(), r.body.data() + len, true };
+        if (decodeStreamFrame(r.state, c, r.frame)) return true;
+    }
+}
+
+// Rebuilds the viewer's world from a decoded frame so display() can draw it.
+void applyStreamFrame(World& w, const StreamFrame& f) {
+    w.score = f.hud[HUD_SCORE];
+    w.lives = f.hud[HUD_LIVES];
+    w.level = f.hud[HUD_LEVEL];
+    w.enemiesDefeated = f.hud[HUD_DEFEATED];
+    w.enemiesForNextLevel = f.hud[HUD_NEXT_LEVEL];
+    w.gameOver = f.hud[HUD_GAMEOVER] != 0;
+    w.players = std::max(1, f.hud[HUD_PLAYERS]);
+    // The viewer never steps its world, so timers and modifiers only carry
+    // the remaining time for display
+    restartTimer(w, w.invulnerableTimer, f.hud[HUD_INVULNERABLE] * 0.1f, TIMER_INVULNERABLE);
+    w.modifiers = ModifierSet();
+    const int stackFields[MOD_KIND_COUNT][2] = {
+        { HUD_MULTISHOT, HUD_MULTISHOT_SECS }, { HUD_SHIELD, HUD_SHIELD_SECS },
+        { HUD_SPEED_BOOST, HUD_SPEED_SECS } };
+    for (int k = 0; k < MOD_KIND_COUNT; k++) {
+        for (int s = 0; s < f.hud[stackFields[k][0]]; s++) {
+            pushModifier(w.modifiers, ModifierKind(k),
+                w.tick + secondsToTicks(float(f.hud[stackFields[k][1]])) + 1, MODIFIER_DEFS[k].magnitude);
+        }
+    }
+    w.simTime += TICK_SECONDS;
+
+    // Keep power-up spawn times so their float animation stays continuous
+    std::vector<PowerUp> oldPowerUps;
+    oldPowerUps.swap(w.powerUps);
+    w.enemies.clear();
+    w.bullets.clear();
+    w.rockets.clear();
+    for (const auto& e : f.entities) {
+        switch (e.kind) {
+        case SK_SHIP:
+            shipOf(w, e.id == 2).x = float(e.x);
+            shipOf(w, e.id == 2).y = float(e.y);
+            break;
+        case SK_ENEMY:
+            w.enemies.emplace_back(float(e.x), float(e.y), int(e.aux & 3));
+            w.enemies.back().health = int(e.aux >> 2);
+            if (w.enemies.back().type == BOSS_TYPE) {
+                // The stream doesn't carry max health; a boss's follows from the level
+                w.enemies.back().maxHealth = std::max(bossHealth(w.level), w.enemies.back().health);
+            }
+            break;
+        case SK_BULLET:
+            w.bullets.emplace_back(float(e.x), float(e.y));
+            break;
+        case SK_ROCKET: {
+            // Only the heading is streamed; drawRocket turns the nose along it
+            float heading = e.aux * 6.2831853f / STREAM_HEADINGS;
+            w.rockets.emplace_back(float(e.x), float(e.y), 0.0f);
+            w.rockets.back().vx = std::cos(heading) * ROCKET_SPEED;
+            w.rockets.back().vy = std::sin(heading) * ROCKET_SPEED;
+            break;
+        }
+        case SK_POWERUP: {
+            float spawnTime = w.simTime;
+            for (const auto& p : oldPowerUps) {
+                if (p.id == e.id) spawnTime = p.spawnTime;
+            }
+            w.powerUps.emplace_back(float(e.x), float(e.y), PowerUpType(e.aux), spawnTime);
+            w.powerUps.back().id = e.id;
+            break;
+        }
+        }
+    }
+
+    w.shots = f.shots;
+
+    updateEffects(w);
+    for (const auto& b : f.bursts) {
+        float r = b.r / 255.0f, g = b.g / 255.0f, bl = b.b / 255.0f;
+        w.explosions.emplace_back(float(b.x), float(b.y), float(b.size), r, g, bl);
+        createParticles(w, float(b.x), float(b.y), 10, r, g, bl);
+    }
+}
+
+StreamReader* replay = nullptr;
+
+// Viewer timer: one stream frame per 16 ms, then redraw through display().
+void replayUpdate(int) {
+    glutPostRedisplay();
+    glutTimerFunc(16, replayUpdate, 0);
+    if (replay->paused || replay->ended) return;
+    if (!readStreamFrame(*replay)) {
+        replay->ended = true;
+        addMessage(world, "End of replay");
+        return;
+    }
+    applyStreamFrame(world, replay->frame);
+}
+
+void replayKeyboard(unsigned char key, int x, int y) {
+    if (key == 27) exit(0);
+    if (key == ' ') replay->paused = !replay->paused;
+}
+
+void closeRecording() {
+    if (recorder) {
+        closeStreamWriter(recorder);
+        recorder = nullptr;
+    }
+}
+
+// ──────────────────────── Audio ────────────────────────
+// Sound runs on its own mixer thread. The game thread only posts commands
+// into a lock-free single-producer ring and never waits: a full ring drops
+// the sound. Every buffer period the mixer starts voices from the ring,
+// mixes all voices into a float buffer (SSE2, four samples at a time),
+// converts to 16-bit stereo and hands the buffer to its sink: a WAV file,
+// raw PCM on stdout for a player such as aplay, or null for benchmarks.
+// Samples are synthesized once at startup into one preloaded pool.
+const int AUDIO_RATE = 44100;
+const int AUDIO_FRAMES = 512;    // stereo frames per buffer, about 11.6 ms
+const int AUDIO_VOICES = 32;     // the oldest voice is stolen past this
+const int AUDIO_QUEUE = 256;     // command ring slots, a power of two
+
+enum AudioSinkKind { AUDIO_NULL, AUDIO_WAV, AUDIO_RAW };
+
+struct SoundSample {
+    int offset, length;   // into the pool, length a multiple of four
+};
+
+struct AudioCommand {
+    SoundId sound;
+    float x;
+    long long postNs;
+};
+
+struct AudioVoice {
+    const float* data;
+    int pos, length;
+    float gain[2];        // left, right
+};
+
+struct AudioMixer {
+    std::vector<float> pool;   // every sample, mono, back to back
+    SoundSample samples[SOUND_COUNT];
+    AudioCommand ring[AUDIO_QUEUE];
+    std::atomic<unsigned int> head;   // next slot the game thread fills
+    std::atomic<unsigned int> tail;   // next slot the mixer reads
+    std::atomic<bool> quit;
+    std::thread thread;
+    AudioSinkKind sink;
+    FILE* file;
+
+    // Game-thread stats
+    long long posted, dropped;
+    double worstPostNs;
+    // Mixer-thread state
+    AudioVoice voices[AUDIO_VOICES];
+    int voiceCount;
+    float mix[AUDIO_FRAMES * 2];
+    short pcm[AUDIO_FRAMES * 2];
+    long long startedPostNs[AUDIO_QUEUE];   // post times of the voices just started
+    long long buffers, late, stolen, heard;
+    double mixSeconds, worstMix, latencyMs, worstLatencyMs;
+
+    AudioMixer()
+        : head(0), tail(0), quit(false), sink(AUDIO_NULL), file(nullptr),
+        posted(0), dropped(0), worstPostNs(0), voiceCount(0), buffers(0), late(0),
+        stolen(0), heard(0), mixSeconds(0), worstMix(0), latencyMs(0), worstLatencyMs(0) {
+    }
+};
+
+// Appends `seconds` of a synthesized sound; `wave` maps time (s) and a
+// noise value in [-1, 1) to a sample.
+template <typename Wave>
+SoundSample synthSound(std::vector<float>& pool, float seconds, Wave wave) {
+    SoundSample s;
+    s.offset = int(pool.size());
+    s.length = (int(seconds * AUDIO_RATE) + 3) & ~3;
+    unsigned int noise = 0x9e3779b9u;
+    for (int i = 0; i < s.length; i++) {
+        noise ^= noise << 13;
+        noise ^= noise >> 17;
+        noise ^= noise << 5;
+        pool.push_back(wave(float(i) / AUDIO_RATE, int(noise >> 8) / 8388608.0f - 1.0f));
+    }
+    return s;
+}
+
+void buildSoundPool(AudioMixer& m) {
+    const float TWO_PI = 6.2831853f;
+    m.pool.reserve(AUDIO_RATE * 2);
+    // Falling square blip
+    m.samples[SOUND_SHOT] = synthSound(m.pool, 0.08f, [&](float t, float) {
+        float phase = (1400.0f * t - 5600.0f * t * t);
+        return (std::fmod(phase, 1.0f) < 0.5f ? 0.2f : -0.2f) * (1.0f - t / 0.08f);
+    });
+    // Noise whoosh over a rising hum
+    float hiss = 0.0f;
+    m.samples[SOUND_ROCKET] = synthSound(m.pool, 0.4f, [&](float t, float n) {
+        hiss += 0.2f * (n - hiss);
+        float env = std::min(t / 0.05f, 1.0f) * (1.0f - t / 0.4f);
+        return (0.35f * hiss + 0.15f * std::sin(TWO_PI * (110.0f * t + 150.0f * t * t))) * env;
+    });
+    // Low rumble: noise through a closing low-pass
+    float rumble = 0.0f;
+    m.samples[SOUND_EXPLOSION] = synthSound(m.pool, 0.7f, [&](float t, float n) {
+        rumble += (0.3f * std::exp(-4.0f * t) + 0.02f) * (n - rumble);
+        return 0.9f * rumble * std::exp(-5.0f * t);
+    });
+    // Two descending buzzes
+    m.samples[SOUND_HIT] = synthSound(m.pool, 0.35f, [&](float t, float n) {
+        float freq = t < 0.15f ? 220.0f : 140.0f;
+        float square = std::fmod(freq * t, 1.0f) < 0.5f ? 1.0f : -1.0f;
+        return (0.2f * square + 0.08f * n) * (1.0f - t / 0.35f);
+    });
+    // Rising arpeggio
+    m.samples[SOUND_POWERUP] = synthSound(m.pool, 0.3f, [&](float t, float) {
+        float freq = t < 0.1f ? 660.0f : t < 0.2f ? 880.0f : 1320.0f;
+        return 0.25f * std::sin(TWO_PI * freq * t) * (1.0f - t / 0.3f);
+    });
+}
+
+// Adds up to one buffer of the voice into `out` (interleaved stereo).
+// Returns the frames mixed.
+int mixVoice(const AudioVoice& v, float* out) {
+    int frames = std::min(AUDIO_FRAMES, v.length - v.pos);
+    const float* src = v.data + v.pos;
+    int i = 0;
+#ifdef __SSE2__
+    // Four mono samples become two stereo pairs per register: [a a b b] and
+    // [c c d d] scaled by [L R L R]
+    __m128 gain = _mm_setr_ps(v.gain[0], v.gain[1], v.gain[0], v.gain[1]);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 s = _mm_loadu_ps(src + i);
+        __m128 lo = _mm_mul_ps(_mm_unpacklo_ps(s, s), gain);
+        __m128 hi = _mm_mul_ps(_mm_unpackhi_ps(s, s), gain);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), lo));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), hi));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[2 * i] += src[i] * v.gain[0];
+        out[2 * i + 1] += src[i] * v.gain[1];
+    }
+    return frames;
+}
+
+// Float mix to saturated 16-bit PCM.
+void convertMix(const float* in, short* out, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 top = _mm_set1_ps(1.0f), bottom = _mm_set1_ps(-1.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), bottom), top);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), bottom), top);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+            _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = short(std::lrint(std::min(std::max(in[i], -1.0f), 1.0f) * 32767.0f));
+    }
+}
+
+// Drains the command ring into voices. Returns how many started.
+int startVoices(AudioMixer& m) {
+    int started = 0;
+    unsigned int t = m.tail.load(std::memory_order_relaxed);
+    unsigned int h = m.head.load(std::memory_order_acquire);
+    for (; t != h; t++) {
+        const AudioCommand& c = m.ring[t % AUDIO_QUEUE];
+        if (m.voiceCount == AUDIO_VOICES) {
+            // Steal the oldest voice; voices are kept in start order
+            memmove(m.voices, m.voices + 1, sizeof(AudioVoice) * (AUDIO_VOICES - 1));
+            m.voiceCount--;
+            m.stolen++;
+        }
+        // Constant-power pan across the screen
+        float pan = std::min(std::max(c.x / windowWidth, 0.0f), 1.0f) * 1.5707963f;
+        const SoundSample& s = m.samples[c.sound];
+        AudioVoice& v = m.voices[m.voiceCount++];
+        v.data = m.pool.data() + s.offset;
+        v.pos = 0;
+        v.length = s.length;
+        v.gain[0] = std::cos(pan);
+        v.gain[1] = std::sin(pan);
+        m.startedPostNs[started++] = c.postNs;
+    }
+    m.tail.store(t, std::memory_order_release);
+    return started;
+}
+
+void writeAudio(AudioMixer& m) {
+    if (m.sink == AUDIO_NULL) return;
+    fwrite(m.pcm, sizeof(short), AUDIO_FRAMES * 2, m.file);
+}
+
+void audioMixerLoop(AudioMixer* m) {
+    TRACE_THREAD("audio mixer");
+    ALLOC_SCOPE(ALLOC_AUDIO);
+    const long long periodNs = 1000000000LL * AUDIO_FRAMES / AUDIO_RATE;
+    long long deadline = monotonicNs();
+    while (!m->quit) {
+        TRACE_SPAN(mixSpan, "mix audio");
+        long long start = monotonicNs();
+        int started = startVoices(*m);
+        memset(m->mix, 0, sizeof(m->mix));
+        for (int i = 0; i < m->voiceCount;) {
+            AudioVoice& v = m->voices[i];
+            v.pos += mixVoice(v, m->mix);
+            if (v.pos < v.length) {
+                i++;
+                continue;
+            }
+            memmove(&v, &v + 1, sizeof(AudioVoice) * (m->voiceCount - i - 1));
+            m->voiceCount--;
+        }
+        convertMix(m->mix, m->pcm, AUDIO_FRAMES * 2);
+        double mixed = (monotonicNs() - start) * 1e-9;
+        m->mixSeconds += mixed;
+        m->worstMix = std::max(m->worstMix, mixed);
+        writeAudio(*m);
+        TRACE_SPAN_END(mixSpan);
+
+        // Latency: post to the first buffer carrying the sound reaching the sink
+        long long out = monotonicNs();
+        for (int i = 0; i < started; i++) {
+            double ms = (out - m->startedPostNs[i]) * 1e-6;
+            m->latencyMs += ms;
+            m->worstLatencyMs = std::max(m->worstLatencyMs, ms);
+        }
+        m->heard += started;
+        m->buffers++;
+
+        // A sink holding one buffer in reserve underruns past the next deadline
+        deadline += periodNs;
+        if (out > deadline + periodNs) {
+            m->late++;
+            deadline = out;
+        }
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::max(deadline - monotonicNs(), 0LL)));
+        endAllocFrame();
+    }
+    mergeAllocStats();
+}
+
+// Writes a 16-bit stereo WAV header; closeAudio patches the sizes.
+void writeWavHeader(FILE* f, unsigned int dataBytes) {
+    unsigned char h[44];
+    auto put32 = [&h](int at, unsigned int v) { for (int i = 0; i < 4; i++) h[at + i] = (unsigned char)(v >> (8 * i)); };
+    auto put16 = [&h](int at, unsigned int v) { h[at] = (unsigned char)v; h[at + 1] = (unsigned char)(v >> 8); };
+    memcpy(h, "RIFF", 4);
+    put32(4, 36 + dataBytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(16, 16);
+    put16(20, 1);                    // PCM
+    put16(22, 2);                    // channels
+    put32(24, AUDIO_RATE);
+    put32(28, AUDIO_RATE * 4);       // bytes per second
+    put16(32, 4);                    // bytes per frame
+    put16(34, 16);                   // bits per sample
+    memcpy(h + 36, "data", 4);
+    put32(40, dataBytes);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+// `path` is "null", "-" (raw s16le stereo on stdout) or a WAV file.
+AudioMixer* openAudio(const char* path) {
+    AudioMixer* m = new AudioMixer();
+    if (!strcmp(path, "-")) {
+        m->sink = AUDIO_RAW;
+        m->file = stdout;
+    }
+    else if (strcmp(path, "null")) {
+        m->sink = AUDIO_WAV;
+        m->file = fopen(path, "wb");
+        if (!m->file) {
+            perror("audio");
+            delete m;
+            return nullptr;
+        }
+        writeWavHeader(m->file, 0);
+    }
+    buildSoundPool(*m);
+    m->thread = std::thread(audioMixerLoop, m);
+    return m;
+}
+
+// Called by the game thread; never waits on the mixer.
+void postSound(AudioMixer& m, SoundId sound, float x) {
+    long long now = monotonicNs();
+    unsigned int h = m.head.load(std::memory_order_relaxed);
+    m.posted++;
+    if (h - m.tail.load(std::memory_order_acquire) >= unsigned(AUDIO_QUEUE)) {
+        m.dropped++;
+        return;
+    }
+    m.ring[h % AUDIO_QUEUE] = { sound, x, now };
+    m.head.store(h + 1, std::memory_order_release);
+    m.worstPostNs = std::max(m.worstPostNs, double(monotonicNs() - now));
+}
+
+void queueSounds(World& w) {
+    if (audio) {
+        for (int i = 0; i < w.sounds.count; i++) {
+            postSound(*audio, w.sounds.cues[i].sound, w.sounds.cues[i].x);
+        }
+    }
+    w.sounds.count = 0;
+}
+
+void closeAudio(AudioMixer* m) {
+    m->quit = true;
+    m->thread.join();
+    if (m->sink == AUDIO_WAV) {
+        rewind(m->file);
+        writeWavHeader(m->file, unsigned(m->buffers * AUDIO_FRAMES * 4));
+        fclose(m->file);
+    }
+    else if (m->file) {
+        fflush(m->file);
+    }
+    double bufferMs = 1000.0 * AUDIO_FRAMES / AUDIO_RATE;
+    double meanMixUs = m->buffers ? m->mixSeconds * 1e6 / m->buffers : 0.0;
+    fprintf(stderr, "Audio: %lld buffers of %.1f ms (%lld late), %lld sounds (%lld dropped, %lld stolen)\n",
+        m->buffers, bufferMs, m->late, m->posted, m->dropped, m->stolen);
+    fprintf(stderr, "  mix     %.1f us/buffer, worst %.1f us (%.2f%% of a core)\n",
+        meanMixUs, m->worstMix * 1e6, meanMixUs / (bufferMs * 10.0));
+    fprintf(stderr, "  latency %.1f ms mean, %.1f ms worst, post to sink; worst post %.0f ns\n",
+        m->heard ? m->latencyMs / m->heard : 0.0, m->worstLatencyMs, m->worstPostNs);
+    delete m;
+}
+
+void closeAudioAtExit() {
+    if (audio) {
+        closeAudio(audio);
+        audio = nullptr;
+    }
+}
+
+// Headless check of the mixer: a bot plays in real time and its sounds go
+// to the sink. Fails if any buffer was late.
+int runAudioBench(int seconds, unsigned int seed) {
+    World w(mixSeed(seed));
+    reserveWorld(w);
+    w.lives = 1 << 30;   // keep playing for the whole run
+    Bot bot;
+    discardAllocFrame();   // setup isn't a frame
+    auto next = std::chrono::steady_clock::now();
+    for (int t = 0; t < seconds * 60; t++) {
+        tickWorld(w, botThink(w, bot));
+        queueSounds(w);
+        endAllocFrame();
+        next += std::chrono::microseconds(16667);
+        std::this_thread::sleep_until(next);
+    }
+    long long late = audio->late;
+    printf("Audio bench: %d s of bot play, seed %u\n", seconds, seed);
+    fflush(stdout);
+    closeAudioAtExit();
+    return late ? 1 : 0;
+}
+
+// ───────────────────── High Scores ─────────────────────
+// Best scores and lifetime stats live in one fixed-layout file that every
+// game process on the machine maps shared (--scores, scores.dat by
+// default). Cabinets write it directly without a database or a server:
+// - A writer takes a lease by CAS: a random owner token and a wall-clock
+//   deadline. An expired lease is taken over, so a dead holder never
+//   blocks the file. Pids are not used: they mean nothing across PID
+//   namespaces and get reused.
+// - The table and stats are double-buffered. A writer rebuilds the
+//   unpublished copy from the published one, then publishes it and drops
+//   the lease in one CAS, which fails if the lease was taken over. A writer
+//   that dies or stalls never publishes a half-written table, and whoever
+//   takes over starts again from the last good one.
+// - Readers never take the lock. They copy the published table and retry
+//   if the sequence moved meanwhile.
+// - The top table is kept sorted on insert, so a top-N query copies a
+//   prefix without scanning.
+// A holder stalled past its lease (stopped in a debugger, say) can still
+// scribble on the copy its successor is building; SCORE_LEASE_MS is set
+// far above any real write to make that a non-issue.
+// The game thread only ever tries the lock. A finished game stays pending
+// and is retried on the next tick until the lock is free.
+#ifndef _WIN32
+const unsigned int SCORE_MAGIC = 0x32435353;   // "SSC2", bump with the layout
+const int SCORE_VERSION = 2;
+const int SCORE_TOP = 100;
+const int SCORE_RECENT = 256;
+const int SCORE_NAME = 16;
+const int SCORE_READ_TRIES = 64;
+const unsigned int SCORE_LEASE_MS = 5000;   // writes take microseconds
+
+struct ScoreEntry {
+    int score, level, seconds;
+    unsigned int when;          // unix time
+    char cabinet[SCORE_NAME];
+};
+
+struct ScoreStats {
+    long long games, totalScore, totalSeconds;
+    long long reachedLevel[MAX_LEVEL + 2];   // games ending on each level
+};
+
+struct ScoreTable {
+    int topCount;
+    ScoreEntry top[SCORE_TOP];        // best first
+    ScoreStats stats;
+};
+
+// Lease word: owner token (bits 33-63, 0 when free), published table
+// (bit 32) and lease deadline in wall-clock ms, truncated (bits 0-31).
+const unsigned long long LEASE_TABLE = 1ull << 32;
+
+unsigned int leaseOwner(unsigned long long lease) { return unsigned(lease >> 33); }
+int leaseTable(unsigned long long lease) { return int((lease >> 32) & 1); }
+
+// The mapped file. A zero-filled file is a valid empty store.
+struct ScoreFile {
+    std::atomic<unsigned int> magic;
+    std::atomic<unsigned int> seq;          // bumped by every write, before it starts
+    std::atomic<unsigned long long> lease;
+    ScoreTable tables[2];                   // the lease says which is published
+    ScoreEntry recent[SCORE_RECENT];        // last games, slot games % SCORE_RECENT
+};
+
+static_assert(std::atomic<unsigned int>::is_always_lock_free &&
+    std::atomic<unsigned long long>::is_always_lock_free,
+    "the score file's atomics are shared between processes");
+static_assert(sizeof(ScoreEntry) == 32, "ScoreEntry is part of the file layout");
+
+struct ScoreStore {
+    ScoreFile* file;
+    unsigned int token;         // this store's lease owner id, never 0
+    char cabinet[SCORE_NAME];
+    bool pending;               // a finished game waiting for the lock
+    ScoreEntry entry;
+    bool submitted;             // the current game over was already queued
+    int lastRank;               // 1-based rank of the last written game, 0 if unplaced
+    long long deferred;         // tries that found the lock held
+};
+
+ScoreStore* openScoreStore(const char* path, const char* cabinet) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("scores");
+        if (fd >= 0) close(fd);
+        return nullptr;
+    }
+    // Never grow someone else's file
+    unsigned int magic = 0;
+    if (st.st_size >= off_t(sizeof(magic)) && (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+        (magic != 0 && magic != SCORE_MAGIC))) {
+        fprintf(stderr, "scores: %s is not a version %d score file\n", path, SCORE_VERSION);
+        close(fd);
+        return nullptr;
+    }
+    // Growing a file zero-fills it, so racing openers agree on the contents
+    if (st.st_size < off_t(sizeof(ScoreFile)) && ftruncate(fd, sizeof(ScoreFile)) < 0) {
+        perror("scores");
+        close(fd);
+        return nullptr;
+    }
+    void* map = mmap(nullptr, sizeof(ScoreFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("scores");
+        return nullptr;
+    }
+    ScoreFile* f = (ScoreFile*)map;
+    magic = 0;
+    if (!f->magic.compare_exchange_strong(magic, SCORE_MAGIC) && magic != SCORE_MAGIC) {
+        fprintf(stderr, "scores: %s is not a version %d score file\n", path, SCORE_VERSION);
+        munmap(map, sizeof(ScoreFile));
+        return nullptr;
+    }
+    ScoreStore* s = new ScoreStore();
+    s->file = f;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    s->token = mixSeed(unsigned(getpid()) ^ unsigned(now.tv_nsec) ^ unsigned(uintptr_t(s))) >> 1 | 1;
+    snprintf(s->cabinet, SCORE_NAME, "%s", cabinet);
+    s->pending = false;
+    s->submitted = false;
+    s->lastRank = 0;
+    s->deferred = 0;
+    return s;
+}
+
+void closeScoreStore(ScoreStore* s) {
+    munmap(s->file, sizeof(ScoreFile));
+    delete s;
+}
+
+// Wall-clock ms, truncated: shared by every process on the machine,
+// whatever PID or time namespace it runs in.
+unsigned int leaseClock() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return unsigned(now.tv_sec * 1000ull + now.tv_nsec / 1000000);
+}
+
+// Takes the lease without waiting, taking over one that has expired.
+// Returns the lease word now held, or 0.
+unsigned long long tryLockScores(ScoreStore& s) {
+    ScoreFile& f = *s.file;
+    unsigned long long lease = f.lease.load(std::memory_order_acquire);
+    unsigned int now = leaseClock();
+    if (leaseOwner(lease) != 0 && int(unsigned(lease) - now) > 0) return 0;
+    unsigned long long mine = (unsigned long long)s.token << 33 | (lease & LEASE_TABLE) |
+        (now + SCORE_LEASE_MS);
+    if (!f.lease.compare_exchange_strong(lease, mine, std::memory_order_acquire)) return 0;
+    return mine;
+}
+
+// Inserts `e` and updates the stats in the unpublished table, then
+// publishes it. Returns false when another process holds the lease, or
+// took it over before this write could publish.
+bool tryWriteScore(ScoreStore& s, const ScoreEntry& e) {
+    ScoreFile& f = *s.file;
+    unsigned long long lease = tryLockScores(s);
+    if (!lease) {
+        s.deferred++;
+        return false;
+    }
+    f.seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Rebuilt from the published table every time, so whatever a writer
+    // that died left in this copy is overwritten
+    int published = leaseTable(lease);
+    const ScoreTable& from = f.tables[published];
+    ScoreTable& to = f.tables[published ^ 1];
+    int count = std::min(std::max(from.topCount, 0), SCORE_TOP);
+    int at = int(std::upper_bound(from.top, from.top + count, e,
+        [](const ScoreEntry& a, const ScoreEntry& b) { return a.score > b.score; }) - from.top);
+    memcpy(to.top, from.top, sizeof(ScoreEntry) * at);
+    to.topCount = count;
+    if (at < SCORE_TOP) {
+        int moved = std::min(count, SCORE_TOP - 1) - at;
+        to.top[at] = e;
+        memcpy(to.top + at + 1, from.top + at, sizeof(ScoreEntry) * moved);
+        to.topCount = std::min(count + 1, SCORE_TOP);
+    }
+    to.stats = from.stats;
+    f.recent[to.stats.games % SCORE_RECENT] = e;
+    to.stats.games++;
+    to.stats.totalScore += e.score;
+    to.stats.totalSeconds += e.seconds;
+    to.stats.reachedLevel[std::min(std::max(e.level, 0), MAX_LEVEL + 1)]++;
+
+    // Publish and release in one step
+    unsigned long long next = (unsigned long long)(published ^ 1) << 32;
+    if (!f.lease.compare_exchange_strong(lease, next, std::memory_order_release)) {
+        s.deferred++;
+        return false;
+    }
+    s.lastRank = at < SCORE_TOP ? at + 1 : 0;
+    return true;
+}
+
+// Copies the best `n` entries (and the stats, if asked). Returns how many
+// were copied, or -1 if writers kept the file busy for every try.
+int readTopScores(const ScoreFile& f, ScoreEntry* out, int n, ScoreStats* stats = nullptr) {
+    for (int attempt = 0; attempt < SCORE_READ_TRIES; attempt++) {
+        unsigned int before = f.seq.load(std::memory_order_acquire);
+        const ScoreTable& t = f.tables[leaseTable(f.lease.load(std::memory_order_acquire))];
+        int count = std::min(std::min(std::max(t.topCount, 0), SCORE_TOP), n);
+        memcpy(out, t.top, sizeof(ScoreEntry) * count);
+        if (stats) memcpy(stats, &t.stats, sizeof(ScoreStats));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (f.seq.load(std::memory_order_relaxed) == before) return count;
+        std::this_thread::yield();
+    }
+    return -1;
+}
+
+// Front-end hook, once per tick: queue a finished game, then retry the
+// write while it is pending.
+void updateScores(ScoreStore& s, const World& w) {
+    if (!w.gameOver) {
+        s.submitted = false;
+    }
+    else if (!s.submitted) {
+        s.submitted = true;
+        s.pending = true;
+        s.entry.score = w.score;
+        s.entry.level = w.level;
+        s.entry.seconds = int(w.simTime);
+        s.entry.when = unsigned(time(nullptr));
+        memcpy(s.entry.cabinet, s.cabinet, SCORE_NAME);
+        s.lastRank = 0;
+    }
+    if (s.pending && tryWriteScore(s, s.entry)) s.pending = false;
+}
+
+// Top five and this game's rank, under the game-over text.
+void drawHighScores(const ScoreStore& s) {
+    static ScoreEntry best[5];
+    static int shown = 0;
+    int n = readTopScores(*s.file, best, 5);
+    if (n >= 0) shown = n;   // else keep the last copy
+    char text[64];
+    float x = windowWidth / 2 - 90, y = windowHeight / 2 + 190;
+    drawText(x, y, "HIGH SCORES");
+    for (int i = 0; i < shown; i++) {
+        y -= 24;
+        snprintf(text, sizeof(text), "%d. %7d  L%-2d %s", i + 1, best[i].score, best[i].level, best[i].cabinet);
+        drawSmallText(x, y, text);
+    }
+    if (s.pending) snprintf(text, sizeof(text), "Saving score...");
+    else if (s.lastRank) snprintf(text, sizeof(text), "Your rank: #%d", s.lastRank);
+    else snprintf(text, sizeof(text), "Not in the top %d", SCORE_TOP);
+    drawSmallText(x, windowHeight / 2 + 30, text);
+}
+
+// --score-stress: `procs` processes hammer one score file at once, each
+// writing `games` results while it reads the top ten back. Afterwards the
+// file must hold every game, and its table must match the best of all
+// results, rebuilt here from the same seeds.
+struct StressResult {
+    long long written, deferred, reads, failedReads, torn;
+    double worstWriteUs;
+};
+
+ScoreEntry stressEntry(unsigned int& rng, int writer) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    ScoreEntry e;
+    memset(&e, 0, sizeof(e));
+    e.score = int(rng % 1000000);
+    e.level = 1 + e.score % MAX_LEVEL;
+    e.seconds = e.score ^ 0x5a5a;   // readers check this to catch torn copies
+    e.when = unsigned(writer);
+    snprintf(e.cabinet, SCORE_NAME, "writer %u", unsigned(writer) % 100000u);
+    return e;
+}
+
+void runStressWriter(const char* path, int writer, int games, StressResult& r) {
+    ScoreStore* s = openScoreStore(path, "stress");
+    if (!s) exit(1);
+    unsigned int rng = mixSeed(unsigned(writer) + 1);
+    ScoreEntry top[10];
+    for (int g = 0; g < games; g++) {
+        ScoreEntry e = stressEntry(rng, writer);
+        auto start = std::chrono::steady_clock::now();
+        while (!tryWriteScore(*s, e)) std::this_thread::yield();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        r.worstWriteUs = std::max(r.worstWriteUs, us);
+        r.written++;
+
+        int n = readTopScores(*s->file, top, 10);
+        r.reads++;
+        if (n < 0) {
+            r.failedReads++;
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (top[i].seconds != (top[i].score ^ 0x5a5a) || (i && top[i].score > top[i - 1].score)) r.torn++;
+        }
+    }
+    r.deferred = s->deferred;
+    closeScoreStore(s);
+}
+
+int runScoreStress(const char* path, int procs, int games) {
+    if (access(path, F_OK) == 0) {
+        fprintf(stderr, "score stress: %s exists; it needs a fresh file\n", path);
+        return 1;
+    }
+    // Results come back through a shared anonymous page
+    void* shared = mmap(nullptr, sizeof(StressResult) * procs, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("score stress");
+        return 1;
+    }
+    StressResult* results = (StressResult*)shared;
+    memset(results, 0, sizeof(StressResult) * procs);
+
+    // Writers wait on a pipe so they all start together once it closes
+    int gate[2];
+    if (pipe(gate) < 0) {
+        perror("score stress");
+        return 1;
+    }
+    for (int p = 0; p < procs; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            char c;
+            close(gate[1]);
+            while (read(gate[0], &c, 1) < 0 && errno == EINTR) {}
+            runStressWriter(path, p, games, results[p]);
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+    close(gate[0]);
+    auto start = std::chrono::steady_clock::now();
+    close(gate[1]);
+    bool crashed = false;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) crashed = true;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Rebuild the expected table from the writers' seeds
+    std::vector<int> expected;
+    long long expectedTotal = 0;
+    for (int p = 0; p < procs; p++) {
+        unsigned int rng = mixSeed(unsigned(p) + 1);
+        for (int g = 0; g < games; g++) {
+            ScoreEntry e = stressEntry(rng, p);
+            expected.push_back(e.score);
+            expectedTotal += e.score;
+        }
+    }
+    std::sort(expected.begin(), expected.end(), std::greater<int>());
+
+    ScoreStore* s = openScoreStore(path, "check");
+    if (!s) return 1;
+    ScoreEntry top[SCORE_TOP];
+    ScoreStats stats;
+    int n = readTopScores(*s->file, top, SCORE_TOP, &stats);
+    bool tableOk = n == std::min(SCORE_TOP, int(expected.size()));
+    for (int i = 0; tableOk && i < n; i++) tableOk = top[i].score == expected[i];
+    closeScoreStore(s);
+
+    StressResult sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int p = 0; p < procs; p++) {
+        sum.written += results[p].written;
+        sum.deferred += results[p].deferred;
+        sum.reads += results[p].reads;
+        sum.failedReads += results[p].failedReads;
+        sum.torn += results[p].torn;
+        sum.worstWriteUs = std::max(sum.worstWriteUs, results[p].worstWriteUs);
+    }
+    munmap(shared, sizeof(StressResult) * procs);
+
+    bool pass = !crashed && tableOk && sum.torn == 0 && stats.games == sum.written &&
+        sum.written == (long long)procs * games && stats.totalScore == expectedTotal;
+    printf("Score stress: %d processes x %d games on %s in %.2f s (%.0f writes/s)\n",
+        procs, games, path, secs, sum.written / secs);
+    printf("  lock busy     %lld tries (%.2f per write), worst write %.0f us\n",
+        sum.deferred, sum.written ? double(sum.deferred) / sum.written : 0.0, sum.worstWriteUs);
+    printf("  reads         %lld, %lld gave up, %lld torn\n", sum.reads, sum.failedReads, sum.torn);
+    printf("  file          %lld games, top %d %s, totals %s: %s\n", stats.games, n,
+        tableOk ? "matches" : "DIFFERS", stats.totalScore == expectedTotal ? "match" : "DIFFER",
+        pass ? "PASS" : "FAIL");
+    unlink(path);
+    return pass ? 0 : 1;
+}
+#endif
+
+// ───────────────────── Session Server ─────────────────────
+// Hosts many worlds in one process for the arcade back end. Each client on
+// the local socket owns one session; the fixed-step ticks of all live
+// sessions are spread over a worker pool every round, and each session
+// gets a compact delta of what changed back after every tick.
+//
+// Wire format (host byte order, local sockets only):
+//   client -> server: one byte per input change, INPUT_* bits below.
+//   server -> client: [u16 length][u32 tick][u8 mask][fields per mask bit].
+#ifndef _WIN32
+enum DeltaField {
+    DELTA_SCORE = 1,      // i32
+    DELTA_LIVES = 2,      // i16
+    DELTA_LEVEL = 4,      // i16
+    DELTA_GAMEOVER = 8,   // u8
+    DELTA_PLAYER = 16,    // i16 x, i16 y
+    DELTA_COUNTS = 32     // u16 enemies, u16 bullets, u16 rockets, u16 powerUps
+};
+
+typedef std::chrono::steady_clock Clock;
+const Clock::duration TICK_PERIOD = std::chrono::milliseconds(16);
+const size_t MAX_PENDING_OUTPUT = 64 * 1024;
+
+// Last state sent to the client, so each tick only ships what changed.
+struct SessionView {
+    int score, lives, level;
+    bool gameOver;
+    short px, py;
+    unsigned short counts[4];
+};
+
+struct Session {
+    World world;
+    ScriptDirector scripts;
+    Bot bot;
+    int fd;                  // client socket, -1 when bot-driven or idle
+    bool active;
+    unsigned char held;      // direction bits last reported by the client
+    unsigned char actions;   // one-shot bits waiting for the next tick
+    bool resync;             // next delta carries every field
+    SessionView sent;
+    std::vector<unsigned char> out;
+    Clock::time_point nextTickAt;
+    unsigned int tick;
+    long long lateTicks;
+
+    Session()
+        : fd(-1), active(false), held(0), actions(0), resync(true), sent(),
+        tick(0), lateTicks(0) {
+    }
+};
+
+// Approximate heap + inline footprint of one world.
+size_t worldBytes(const World& w) {
+    size_t bytes = sizeof(World);
+    bytes += w.bullets.capacity() * sizeof(Bullet);
+    bytes += w.enemies.capacity() * sizeof(Enemy);
+    bytes += w.rockets.capacity() * sizeof(Rocket);
+    bytes += w.explosions.capacity() * sizeof(Explosion);
+    bytes += w.powerUps.capacity() * sizeof(PowerUp);
+    bytes += w.particles.capacity() * sizeof(Particle);
+    bytes += w.shots.x.capacity() * 4 * sizeof(float);
+    bytes += (w.enemyGrid.cellStart.capacity() + w.enemyGrid.cellItems.capacity()) * sizeof(int);
+    return bytes;
+}
+
+template <typename T>
+void putRaw(std::vector<unsigned char>& out, T v) {
+    unsigned char buf[sizeof(T)];
+    memcpy(buf, &v, sizeof(T));
+    out.insert(out.end(), buf, buf + sizeof(T));
+}
+
+void encodeSessionDelta(Session& s) {
+    const World& w = s.world;
+    SessionView now;
+    now.score = w.score;
+    now.lives = w.lives;
+    now.level = w.level;
+    now.gameOver = w.gameOver;
+    now.px = short(w.player.x);
+    now.py = short(w.player.y);
+    now.counts[0] = (unsigned short)w.enemies.size();
+    now.counts[1] = (unsigned short)w.bullets.size();
+    now.counts[2] = (unsigned short)w.rockets.size();
+    now.counts[3] = (unsigned short)w.powerUps.size();
+
+    unsigned char mask = 0;
+    if (s.resync || now.score != s.sent.score) mask |= DELTA_SCORE;
+    if (s.resync || now.lives != s.sent.lives) mask |= DELTA_LIVES;
+    if (s.resync || now.level != s.sent.level) mask |= DELTA_LEVEL;
+    if (s.resync || now.gameOver != s.sent.gameOver) mask |= DELTA_GAMEOVER;
+    if (s.resync || now.px != s.sent.px || now.py != s.sent.py) mask |= DELTA_PLAYER;
+    if (s.resync || memcmp(now.counts, s.sent.counts, sizeof(now.counts))) mask |= DELTA_COUNTS;
+    s.sent = now;
+    s.resync = false;
+
+    if (s.out.size() > MAX_PENDING_OUTPUT) {
+        // Client is not draining; drop this frame and send everything next time
+        s.resync = true;
+        return;
+    }
+
+    size_t start = s.out.size();
+    putRaw<unsigned short>(s.out, 0);
+    putRaw<unsigned int>(s.out, s.tick);
+    putRaw<unsigned char>(s.out, mask);
+    if (mask & DELTA_SCORE) putRaw<int>(s.out, now.score);
+    if (mask & DELTA_LIVES) putRaw<short>(s.out, short(now.lives));
+    if (mask & DELTA_LEVEL) putRaw<short>(s.out, short(now.level));
+    if (mask & DELTA_GAMEOVER) putRaw<unsigned char>(s.out, now.gameOver);
+    if (mask & DELTA_PLAYER) {
+        putRaw<short>(s.out, now.px);
+        putRaw<short>(s.out, now.py);
+    }
+    if (mask & DELTA_COUNTS) {
+        for (int i = 0; i < 4; i++) putRaw<unsigned short>(s.out, now.counts[i]);
+    }
+    unsigned short len = (unsigned short)(s.out.size() - start - 2);
+    memcpy(&s.out[start], &len, 2);
+}
+
+// Persistent workers that run one job per round and then park again.
+struct TickPool {
+    std::vector<std::thread> threads;
+    std::mutex m;
+    std::condition_variable wake, done;
+    std::function<void(int)> job;
+    unsigned long long generation;
+    int running;
+    bool quit;
+    std::vector<double> busySeconds;
+
+    explicit TickPool(int n) : generation(0), running(0), quit(false), busySeconds(n, 0.0) {
+        for (int i = 0; i < n; i++) threads.emplace_back(&TickPool::loop, this, i);
+    }
+
+    ~TickPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void loop(int id) {
+        TRACE_THREAD("tick worker");
+        unsigned long long seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit) {
+                    mergeAllocStats();
+                    return;
+                }
+                seen = generation;
+            }
+            TRACE_SPAN(jobSpan, "tick job");
+            auto start = Clock::now();
+            job(id);
+            TRACE_SPAN_END(jobSpan);
+            endAllocFrame();
+            busySeconds[id] += std::chrono::duration<double>(Clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(m);
+            if (--running == 0) done.notify_one();
+        }
+    }
+
+    // Runs `fn` once on every worker and waits for all of them.
+    void run(const std::function<void(int)>& fn) {
+        std::unique_lock<std::mutex> lock(m);
+        job = fn;
+        running = int(threads.size());
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [&] { return running == 0; });
+    }
+};
+
+// Advances one session through every tick that is due, catching up at most
+// a few ticks before giving up on the backlog.
+int stepSession(Session& s, Clock::time_point now) {
+    int steps = 0;
+    while (now >= s.nextTickAt && steps < 4) {
+        if (s.fd >= 0) {
+            tickWorld(s.world, s.held | s.actions);
+            s.actions = 0;
+        }
+        else {
+            tickWorld(s.world, botThink(s.world, s.bot));
+        }
+        s.tick++;
+        if (s.fd >= 0) encodeSessionDelta(s);
+
+        Clock::time_point deadline = s.nextTickAt + TICK_PERIOD;
+        s.nextTickAt += TICK_PERIOD;
+        steps++;
+        if (Clock::now() > deadline) s.lateTicks++;
+    }
+    if (now >= s.nextTickAt) {
+        // Too far behind: drop the backlog rather than spiral
+        s.lateTicks++;
+        s.nextTickAt = now + TICK_PERIOD;
+    }
+    return steps;
+}
+
+void closeClient(Session& s) {
+    close(s.fd);
+    s.fd = -1;
+    s.out.clear();
+}
+
+int runServer(const char* path, int sessionCount, int threads, bool bots, int seconds) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listenFd, 64) < 0) {
+        perror("server socket");
+        return 1;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    std::vector<Session> sessions(sessionCount);
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < sessionCount; i++) {
+        sessions[i].world = World(mixSeed(i + 1));
+        attachDirector(sessions[i].world, sessions[i].scripts);
+        sessions[i].active = bots;
+        sessions[i].nextTickAt = start;
+    }
+
+    TickPool pool(threads);
+    std::atomic<int> nextSession(0);
+    std::atomic<long long> stepsThisRound(0);
+    long long totalSteps = 0;
+    long long lastSteps = 0;
+    Clock::time_point lastReport = start;
+    Clock::time_point roundAt = start;
+
+    printf("Server: %d sessions on %s, %d worker threads%s\n",
+        sessionCount, path, threads, bots ? ", idle sessions bot-driven" : "");
+
+    while (seconds <= 0 || Clock::now() - start < std::chrono::seconds(seconds)) {
+        // — Accept new clients into free sessions
+        for (;;) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) break;
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            Session* free = nullptr;
+            for (auto& s : sessions) {
+                if (s.fd < 0) { free = &s; break; }
+            }
+            if (!free) {
+                close(fd);
+                continue;
+            }
+            free->fd = fd;
+            free->active = true;
+            free->held = 0;
+            free->actions = 0;
+            free->resync = true;
+            free->world = World(mixSeed(unsigned(free - &sessions[0]) + 1));
+            attachDirector(free->world, free->scripts);
+            free->nextTickAt = Clock::now();
+        }
+
+        // — Drain client input
+        for (auto& s : sessions) {
+            if (s.fd < 0) continue;
+            unsigned char buf[256];
+            for (;;) {
+                ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+                if (n > 0) {
+                    for (ssize_t i = 0; i < n; i++) {
+                        s.held = buf[i] & INPUT_HELD;
+                        s.actions |= buf[i] & ~INPUT_HELD;
+                    }
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    closeClient(s);
+                    s.active = bots;
+                }
+                break;
+            }
+        }
+
+        // — Tick every due session on the pool
+        Clock::time_point now = Clock::now();
+        nextSession = 0;
+        stepsThisRound = 0;
+        pool.run([&](int) {
+            long long steps = 0;
+            for (int i = nextSession++; i < sessionCount; i = nextSession++) {
+                if (sessions[i].active) steps += stepSession(sessions[i], now);
+            }
+            stepsThisRound += steps;
+        });
+        totalSteps += stepsThisRound;
+
+        // — Flush deltas
+        for (auto& s : sessions) {
+            if (s.fd < 0 || s.out.empty()) continue;
+            ssize_t n = send(s.fd, s.out.data(), s.out.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                s.out.erase(s.out.begin(), s.out.begin() + n);
+            }
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeClient(s);
+                s.active = bots;
+            }
+        }
+
+        if (Clock::now() - lastReport >= std::chrono::seconds(1)) {
+            double dt = std::chrono::duration<double>(Clock::now() - lastReport).count();
+            int clients = 0;
+            long long late = 0;
+            for (const auto& s : sessions) {
+                clients += s.fd >= 0;
+                late += s.lateTicks;
+            }
+            printf("  %d clients, %.0f ticks/s, %lld late ticks\n",
+                clients, (totalSteps - lastSteps) / dt, late);
+            fflush(stdout);
+            lastSteps = totalSteps;
+            lastReport = Clock::now();
+        }
+
+        roundAt += TICK_PERIOD;
+        if (roundAt < Clock::now()) roundAt = Clock::now();
+        std::this_thread::sleep_until(roundAt);
+    }
+
+    double busy = 0;
+    for (double b : pool.busySeconds) busy += b;
+    size_t totalBytes = 0, maxBytes = 0;
+    long long late = 0;
+    for (const auto& s : sessions) {
+        size_t b = worldBytes(s.world) + sizeof(Session) - sizeof(World) + s.out.capacity()
+            + s.scripts.arena.buffer.capacity();
+        totalBytes += b;
+        maxBytes = std::max(maxBytes, b);
+        late += s.lateTicks;
+    }
+    double wall = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("Server summary: %lld session ticks in %.1fs\n", totalSteps, wall);
+    printf("  ticks/s/core  %.0f (busy %.2fs across %d workers)\n",
+        busy > 0 ? totalSteps / busy : 0.0, busy, threads);
+    printf("  memory/session  mean %.1f KB, max %.1f KB\n",
+        totalBytes / 1024.0 / std::max(1, sessionCount), maxBytes / 1024.0);
+    printf("  late ticks    %lld\n", late);
+
+    for (auto& s : sessions) {
+        if (s.fd >= 0) closeClient(s);
+    }
+    close(listenFd);
+    unlink(path);
+    return 0;
+}
+
+// Loopback client stub: plays scripted input on several connections and
+// reports how many deltas and bytes came back.
+int runClientStub(const char* path, int clients, int seconds) {
+    std::vector<int> fds;
+    for (int i = 0; i < clients; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("client connect");
+            return 1;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fds.push_back(fd);
+    }
+
+    std::vector<std::vector<unsigned char>> pending(clients);
+    std::vector<long long> frames(clients, 0), bytes(clients, 0);
+    std::vector<int> lastScore(clients, 0);
+    Clock::time_point start = Clock::now();
+    Clock::time_point at = start;
+    for (int tick = 0; Clock::now() - start < std::chrono::seconds(seconds); tick++) {
+        for (int c = 0; c < clients; c++) {
+            // Sway across the screen while firing
+            unsigned char in = ((tick / 60 + c) % 2) ? INPUT_LEFT : INPUT_RIGHT;
+            if (tick % 6 == 0) in |= INPUT_FIRE;
+            if (tick % 120 == 0) in |= INPUT_ROCKET | INPUT_RESTART;
+            send(fds[c], &in, 1, MSG_NOSIGNAL);
+
+            unsigned char buf[4096];
+            ssize_t n;
+            while ((n = recv(fds[c], buf, sizeof(buf), 0)) > 0) {
+                pending[c].insert(pending[c].end(), buf, buf + n);
+                bytes[c] += n;
+            }
+            // Parse whole frames
+            size_t off = 0;
+            while (pending[c].size() - off >= 2) {
+                unsigned short len;
+                memcpy(&len, &pending[c][off], 2);
+                if (pending[c].size() - off < size_t(len) + 2) break;
+                const unsigned char* p = &pending[c][off + 2];
+                if (p[4] & DELTA_SCORE) memcpy(&lastScore[c], p + 5, 4);
+                frames[c]++;
+                off += len + 2;
+            }
+            pending[c].erase(pending[c].begin(), pending[c].begin() + off);
+        }
+        at += TICK_PERIOD;
+        std::this_thread::sleep_until(at);
+    }
+
+    double wall = std::chrono::duration<double>(Clock::now() - start).count();
+    long long allFrames = 0, allBytes = 0;
+    for (int c = 0; c < clients; c++) {
+        allFrames += frames[c];
+        allBytes += bytes[c];
+        close(fds[c]);
+    }
+    printf("Client stub: %d connections, %.1f deltas/s each, %.1f B/delta, last score %d\n",
+        clients, allFrames / wall / clients,
+        allFrames ? double(allBytes) / allFrames : 0.0, lastScore[0]);
+    return allFrames > 0 ? 0 : 1;
+}
+#endif
+
+// ───────────────────── Rollback Netcode ─────────────────────
+// GGPO-style two-player co-op over UDP. Both peers run the full simulation
+// and only exchange inputs. The remote ship's input is predicted (hold the
+// last confirmed directions, no actions); every frame's pre-step state is
+// kept in a snapshot ring, and when a confirmed input contradicts what was
+// predicted, the world is restored to that frame and re-simulated forward.
+#ifndef _WIN32
+const int ROLLBACK_FRAMES = 64;        // snapshot/input history, about 1 s
+const int MAX_INPUTS_PER_PACKET = 32;
+
+struct NetPacket {
+    Clock::time_point sendAt;
+    int len;
+    unsigned char data[64];
+};
+
+// A rollback snapshot: the state a step reads or writes, in lists reserved
+// to the pool sizes so saving and restoring only copy. The enemy grid is
+// scratch the step rebuilds, and netplay worlds have no director.
+struct WorldSnapshot {
+    GameObject player, player2;
+    int players;
+    std::vector<Bullet> bullets;
+    std::vector<Enemy> enemies;
+    std::vector<Rocket> rockets;
+    std::vector<Explosion> explosions;
+    std::vector<PowerUp> powerUps;
+    std::vector<Particle> particles;
+    EnemyShots shots;
+    MessageLog messageLog;
+    SoundQueue sounds;
+    int score, level, lives, enemiesDefeated, enemiesForNextLevel;
+    bool gameOver;
+    ModifierSet modifiers;
+    TimerWheel timers;
+    int spawnTimer, invulnerableTimer;
+    float simTime;
+    unsigned int tick, nextId, rngState;
+
+    WorldSnapshot() : player(0, 0, 0, 0), player2(0, 0, 0, 0) {
+        reservePools(*this);
+    }
+};
+
+// Saves (World to snapshot) or restores (snapshot to World). Vector
+// assignment reuses the destination's pool-sized storage.
+template <class To, class From>
+void copySimState(To& to, const From& from) {
+    to.player = from.player;
+    to.player2 = from.player2;
+    to.players = from.players;
+    to.bullets = from.bullets;
+    to.enemies = from.enemies;
+    to.rockets = from.rockets;
+    to.explosions = from.explosions;
+    to.powerUps = from.powerUps;
+    to.particles = from.particles;
+    to.shots = from.shots;
+    to.messageLog = from.messageLog;
+    to.sounds = from.sounds;
+    to.score = from.score;
+    to.level = from.level;
+    to.lives = from.lives;
+    to.enemiesDefeated = from.enemiesDefeated;
+    to.enemiesForNextLevel = from.enemiesForNextLevel;
+    to.gameOver = from.gameOver;
+    to.modifiers = from.modifiers;
+    to.timers = from.timers;
+    to.spawnTimer = from.spawnTimer;
+    to.invulnerableTimer = from.invulnerableTimer;
+    to.simTime = from.simTime;
+    to.tick = from.tick;
+    to.nextId = from.nextId;
+    to.rngState = from.rngState;
+}
+
+struct RollbackSession {
+    World& world;
+    int local;                                    // ship index this peer drives
+    int fd;
+    sockaddr_in remote;
+
+    WorldSnapshot snapshots[ROLLBACK_FRAMES];     // state before frame f, at f % ROLLBACK_FRAMES
+    unsigned char localInput[ROLLBACK_FRAMES];
+    unsigned char remoteInput[ROLLBACK_FRAMES];   // confirmed remote input
+    int remoteTag[ROLLBACK_FRAMES];               // frame held in remoteInput, -1 if none
+    unsigned char usedRemote[ROLLBACK_FRAMES];    // remote input the simulation used
+    int frame;                                    // next frame to simulate
+    int remoteConfirmed;                          // every remote input up to here is known
+    int remoteAcked;                              // peer has every local input up to here
+    int rollbackFrom;                             // earliest mispredicted frame, or -1
+    unsigned char pendingActions;                 // one-shot bits from stalled frames
+
+    // Desync detection: checksums of the state before each finalized frame
+    unsigned int sums[ROLLBACK_FRAMES];
+    int sumTag[ROLLBACK_FRAMES];
+    unsigned int peerSums[ROLLBACK_FRAMES];
+    int peerSumTag[ROLLBACK_FRAMES];
+    int lastSummed;
+    int lastCompared;
+
+    // Fault injection for loopback testing
+    int latencyMs, jitterMs, lossPct;
+    std::vector<NetPacket> outbox;
+
+    // Stats
+    std::vector<float> saveUs;       // snapshot save, per simulated or re-simulated frame
+    std::vector<float> restoreUs;    // snapshot restore, per rollback
+    std::vector<float> rollbackUs;   // restore + re-simulation, per rollback
+    long long frames, rollbacks, resimFrames, stalls, checksOk, desyncs;
+
+    RollbackSession(World& w, int who)
+        : world(w), local(who), fd(-1), remote(), frame(0), remoteConfirmed(-1),
+        remoteAcked(-1), rollbackFrom(-1), pendingActions(0), lastSummed(-1), lastCompared(-1),
+        latencyMs(0), jitterMs(0), lossPct(0),
+        frames(0), rollbacks(0), resimFrames(0), stalls(0), checksOk(0), desyncs(0) {
+        for (int i = 0; i < ROLLBACK_FRAMES; i++) {
+            remoteTag[i] = sumTag[i] = peerSumTag[i] = -1;
+        }
+    }
+};
+
+const ScriptDirector* directorOf(const World& w) { return w.director; }
+const ScriptDirector* directorOf(const WorldSnapshot&) { return nullptr; }
+
+// FNV-1a over everything a step reads, field by field so that vtable
+// pointers and padding stay out of it. The message log and sound queue are
+// only written, so they are left out.
+template <class State>
+unsigned int worldChecksum(const State& w) {
+    unsigned int h = 2166136261u;
+    auto mix = [&](const auto& v) {
+        const unsigned char* b = (const unsigned char*)&v;
+        for (size_t i = 0; i < sizeof(v); i++) h = (h ^ b[i]) * 16777619u;
+    };
+    auto mixFloats = [&](const std::vector<float>& v) {
+        for (float f : v) mix(f);
+    };
+    auto mixObject = [&](const GameObject& o) {
+        mix(o.x); mix(o.y); mix(o.width); mix(o.height); mix(o.id);
+    };
+    mix(w.rngState); mix(w.simTime); mix(w.tick); mix(w.nextId);
+    mix(w.score); mix(w.lives); mix(w.level); mix(w.gameOver);
+    mix(w.enemiesDefeated); mix(w.enemiesForNextLevel);
+    mix(w.players);
+    mixObject(w.player);
+    mixObject(w.player2);
+
+    mix(w.bullets.size());
+    for (const auto& b : w.bullets) {
+        mixObject(b); mix(b.angle);
+    }
+    mix(w.enemies.size());
+    for (const auto& e : w.enemies) {
+        mixObject(e);
+        mix(e.health); mix(e.maxHealth); mix(e.type); mix(e.vx); mix(e.phase);
+        mix(e.watched); mix(e.fireCooldown); mix(e.shotAngle);
+    }
+    mix(w.rockets.size());
+    for (const auto& r : w.rockets) {
+        mixObject(r); mix(r.spawnTime); mix(r.vx); mix(r.vy);
+    }
+    mix(w.powerUps.size());
+    for (const auto& p : w.powerUps) {
+        mixObject(p); mix(p.type); mix(p.spawnTime);
+    }
+    mix(w.explosions.size());
+    for (const auto& e : w.explosions) {
+        mix(e.x); mix(e.y); mix(e.size); mix(e.alpha);
+    }
+    mix(w.particles.size());
+    for (const auto& p : w.particles) {
+        mix(p.x); mix(p.y); mix(p.vx); mix(p.vy); mix(p.lifetime); mix(p.alpha);
+    }
+    mixFloats(w.shots.x);
+    mixFloats(w.shots.y);
+    mixFloats(w.shots.vx);
+    mixFloats(w.shots.vy);
+
+    const ModifierSet& m = w.modifiers;
+    mix(m.heapSize);
+    mix(m.stacks);
+    mix(m.magnitude);
+    for (int i = 0; i < m.heapSize; i++) {
+        const ActiveModifier& a = m.slots[m.heap[i]];
+        mix(m.heap[i]); mix(a.expires); mix(a.magnitude); mix(a.kind);
+    }
+
+    // Free timer nodes keep stale fields, so only live ones are hashed whole
+    const TimerWheel& tw = w.timers;
+    mix(tw.now);
+    mix(tw.heads);
+    mix(tw.freeHead);
+    for (const TimerNode& n : tw.nodes) {
+        mix(n.slot); mix(n.next); mix(n.generation);
+        if (n.slot >= 0) {
+            mix(n.due); mix(n.prev); mix(n.event);
+        }
+    }
+    mix(w.spawnTimer);
+    mix(w.invulnerableTimer);
+
+    if (const ScriptDirector* d = directorOf(w)) {
+        mix(d->cleared); mix(d->seq); mix(d->bossId);
+        for (const auto* list : { &d->sleeping, &d->clearing, &d->leveling, &d->watching }) {
+            mix(list->size());
+            for (const ScriptWaiter& x : *list) {
+                mix(x.key); mix(x.seq); mix(x.id);
+            }
+        }
+    }
+    return h;
+}
+
+float elapsedUs(Clock::time_point since) {
+    return std::chrono::duration<float, std::micro>(Clock::now() - since).count();
+}
+
+unsigned char remoteInputFor(const RollbackSession& s, int f) {
+    int slot = f % ROLLBACK_FRAMES;
+    if (s.remoteTag[slot] == f) return s.remoteInput[slot];
+    if (s.remoteConfirmed < 0) return 0;
+    return s.remoteInput[s.remoteConfirmed % ROLLBACK_FRAMES] & INPUT_HELD;
+}
+
+void simulateFrame(RollbackSession& s, int f) {
+    int slot = f % ROLLBACK_FRAMES;
+    Clock::time_point t0 = Clock::now();
+    copySimState(s.snapshots[slot], s.world);
+    s.saveUs.push_back(elapsedUs(t0));
+    unsigned char remote = remoteInputFor(s, f);
+    s.usedRemote[slot] = remote;
+    if (s.local == 0) tickWorld(s.world, s.localInput[slot], remote);
+    else tickWorld(s.world, remote, s.localInput[slot]);
+}
+
+void compareChecksum(RollbackSession& s, int f) {
+    int slot = f % ROLLBACK_FRAMES;
+    if (f <= s.lastCompared || s.sumTag[slot] != f || s.peerSumTag[slot] != f) return;
+    if (s.sums[slot] == s.peerSums[slot]) s.checksOk++;
+    else s.desyncs++;
+    s.lastCompared = f;
+}
+
+bool inHistory(const RollbackSession& s, int f) {
+    return f >= s.frame - ROLLBACK_FRAMES && f < s.frame + ROLLBACK_FRAMES;
+}
+
+// Packets from anyone but the peer, or with fields that could not come
+// from a peer in step with this one, are dropped whole.
+void pollNetplay(RollbackSession& s) {
+    unsigned char buf[128];
+    ssize_t n;
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    while ((n = recvfrom(s.fd, buf, sizeof(buf), 0, (sockaddr*)&from, &fromLen)) >= 0) {
+        bool fromPeer = fromLen == sizeof(from) && from.sin_port == s.remote.sin_port &&
+            from.sin_addr.s_addr == s.remote.sin_addr.s_addr;
+        fromLen = sizeof(from);
+        if (!fromPeer || n < 17) continue;
+        int start, ack, sumFrame;
+        unsigned int sum;
+        int count = buf[4];
+        if (count > MAX_INPUTS_PER_PACKET || n < 17 + count) continue;
+        memcpy(&start, buf, 4);
+        memcpy(&ack, buf + 5 + count, 4);
+        memcpy(&sumFrame, buf + 9 + count, 4);
+        memcpy(&sum, buf + 13 + count, 4);
+        if (start < 0 || ack < -1 || ack >= s.frame) continue;
+
+        for (int i = 0; i < count; i++) {
+            int f = start + i;
+            if (!inHistory(s, f)) continue;
+            int slot = f % ROLLBACK_FRAMES;
+            if (f <= s.remoteConfirmed || s.remoteTag[slot] == f) continue;
+            s.remoteInput[slot] = buf[5 + i];
+            s.remoteTag[slot] = f;
+            if (f < s.frame && s.usedRemote[slot] != buf[5 + i]) {
+                if (s.rollbackFrom < 0 || f < s.rollbackFrom) s.rollbackFrom = f;
+            }
+        }
+        while (s.remoteTag[(s.remoteConfirmed + 1) % ROLLBACK_FRAMES] == s.remoteConfirmed + 1) {
+            s.remoteConfirmed++;
+        }
+        s.remoteAcked = std::max(s.remoteAcked, ack);
+
+        // The peer's checksums trail its inputs, often by more than the
+        // history; the tags keep stale ones from being compared
+        if (sumFrame >= 0 && sumFrame < s.frame + ROLLBACK_FRAMES) {
+            s.peerSums[sumFrame % ROLLBACK_FRAMES] = sum;
+            s.peerSumTag[sumFrame % ROLLBACK_FRAMES] = sumFrame;
+            compareChecksum(s, sumFrame);
+        }
+    }
+}
+
+// Queues this frame's packet through the latency/jitter/loss injector and
+// sends whatever is due.
+void sendNetplay(RollbackSession& s) {
+    NetPacket p;
+    int start = std::max(s.remoteAcked + 1, s.frame - MAX_INPUTS_PER_PACKET);
+    int count = std::max(0, s.frame - start);
+    memcpy(p.data, &start, 4);
+    p.data[4] = (unsigned char)count;
+    for (int i = 0; i < count; i++) p.data[5 + i] = s.localInput[(start + i) % ROLLBACK_FRAMES];
+    unsigned int sum = s.lastSummed >= 0 ? s.sums[s.lastSummed % ROLLBACK_FRAMES] : 0;
+    memcpy(p.data + 5 + count, &s.remoteConfirmed, 4);
+    memcpy(p.data + 9 + count, &s.lastSummed, 4);
+    memcpy(p.data + 13 + count, &sum, 4);
+    p.len = 17 + count;
+
+    Clock::time_point now = Clock::now();
+    int delay = s.latencyMs + (s.jitterMs > 0 ? std::rand() % (s.jitterMs + 1) : 0);
+    p.sendAt = now + std::chrono::milliseconds(delay);
+    if (s.lossPct <= 0 || std::rand() % 100 >= s.lossPct) s.outbox.push_back(p);
+
+    for (size_t i = 0; i < s.outbox.size();) {
+        if (s.outbox[i].sendAt <= now) {
+            sendto(s.fd, s.outbox[i].data, s.outbox[i].len, 0,
+                (sockaddr*)&s.remote, sizeof(s.remote));
+            s.outbox[i] = s.outbox.back();
+            s.outbox.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+// One 16 ms frame of netplay: apply late inputs (rolling back if needed),
+// simulate the next frame unless too far ahead of the peer, then send.
+void rollbackFrame(RollbackSession& s, unsigned char localBits) {
+    pollNetplay(s);
+
+    ALLOC_SCOPE(ALLOC_NET);
+    if (s.rollbackFrom >= 0) {
+        TRACE_SCOPE("rollback");
+        Clock::time_point t0 = Clock::now();
+        copySimState(s.world, s.snapshots[s.rollbackFrom % ROLLBACK_FRAMES]);
+        s.restoreUs.push_back(elapsedUs(t0));
+        for (int f = s.rollbackFrom; f < s.frame; f++) simulateFrame(s, f);
+        s.world.sounds.count = 0;   // these frames were already heard
+        s.rollbackUs.push_back(elapsedUs(t0));
+        s.rollbacks++;
+        s.resimFrames += s.frame - s.rollbackFrom;
+        s.rollbackFrom = -1;
+    }
+
+    if (s.frame - s.remoteConfirmed >= ROLLBACK_FRAMES - 1) {
+        // Out of history: wait for the peer instead of predicting further.
+        // The queue has already been drained, so keep this frame's presses
+        // for the next frame that runs.
+        s.pendingActions |= localBits & ~INPUT_HELD;
+        s.stalls++;
+    }
+    else {
+        s.localInput[s.frame % ROLLBACK_FRAMES] = localBits | s.pendingActions;
+        s.pendingActions = 0;
+        simulateFrame(s, s.frame);
+        s.frame++;
+        s.frames++;
+    }
+
+    // The state before the first frame lacking remote input is final
+    int final = std::min(s.frame, s.remoteConfirmed + 1);
+    if (final > s.lastSummed) {
+        int slot = final % ROLLBACK_FRAMES;
+        s.sums[slot] = final == s.frame ? worldChecksum(s.world) : worldChecksum(s.snapshots[slot]);
+        s.sumTag[slot] = final;
+        s.lastSummed = final;
+        compareChecksum(s, final);
+    }
+
+    sendNetplay(s);
+}
+
+bool openNetplay(RollbackSession& s, int port, int remotePort) {
+    s.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (s.fd < 0 || bind(s.fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("netplay socket");
+        return false;
+    }
+    fcntl(s.fd, F_SETFL, O_NONBLOCK);
+    s.remote = addr;
+    s.remote.sin_port = htons((unsigned short)remotePort);
+    return true;
+}
+
+void setupCoop(World& w, unsigned int seed) {
+    w = World(mixSeed(seed));
+    reserveWorld(w);
+    w.players = 2;
+    w.player.x = windowWidth / 3 - 25;
+}
+
+void printNetplayReport(const RollbackSession& s) {
+    auto stats = [](const char* label, std::vector<float> v) {
+        std::sort(v.begin(), v.end());
+        double sum = 0;
+        for (float x : v) sum += x;
+        printf("  %-16s mean %8.2f us  p99 %8.2f us  max %8.2f us  (n=%zu)\n", label,
+            v.empty() ? 0.0 : sum / v.size(), percentile(v, 0.99f),
+            v.empty() ? 0.0f : v.back(), v.size());
+    };
+    double rollbackTotal = 0;
+    for (float x : s.rollbackUs) rollbackTotal += x;
+    printf("Netplay peer %d: %lld frames, %lld rollbacks (avg depth %.1f frames), %lld stalls\n",
+        s.local, s.frames, s.rollbacks,
+        s.rollbacks ? double(s.resimFrames) / s.rollbacks : 0.0, s.stalls);
+    stats("snapshot save", s.saveUs);
+    stats("restore", s.restoreUs);
+    stats("restore+resim", s.rollbackUs);
+    printf("  rollback cost   %.2f us per resimulated frame, %.2f us per frame amortized\n",
+        s.resimFrames ? rollbackTotal / s.resimFrames : 0.0,
+        s.frames ? rollbackTotal / s.frames : 0.0);
+    printf("  checksums       %lld matched, %lld desynced\n", s.checksOk, s.desyncs);
+}
+
+// Headless peer: the autopilot drives the local ship.
+int runNetplayHeadless(RollbackSession& s, int seconds) {
+    Bot bot;
+    Clock::time_point start = Clock::now();
+    Clock::time_point at = start;
+    while (Clock::now() - start < std::chrono::seconds(seconds)) {
+        rollbackFrame(s, botThink(s.world, bot, s.local));
+        endAllocFrame();
+        at += TICK_PERIOD;
+        std::this_thread::sleep_until(at);
+    }
+    printNetplayReport(s);
+    return s.desyncs ? 1 : 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    // Headless batch mode: --batch N [--threads T] [--seed S] [--max-ticks M]
+    // Session server:    --server PATH [--sessions N] [--threads T] [--bots] [--seconds S]
+    // Client stub:       --client PATH [--clients N] [--seconds S]
+    // Record / replay:   --record FILE|- (with normal or netplay games), --replay FILE|-
+    // Co-op netplay:     --peer 0|1 --port P --remote-port Q [--latency MS]
+    //                    [--jitter MS] [--loss PCT] [--seed S] [--headless --seconds S]
+    // Tracing:           --trace FILE (any mode; needs a -DSHOOTER_TRACE build)
+    // Allocations:       --alloc-report, --alloc-guard WARMUP_TICKS (any mode)
+    // Level tuning:      --levels FILE (any mode), --print-levels
+    // Rendering:         --dirty-rects (redraw only changed regions)
+    // Audio:             --audio null|-|FILE.wav (game, netplay), --audio-bench SECONDS
+    // Input:             --fire-rate SHOTS_PER_SECOND (0: one per press), --input-report
+    // High scores:       --scores FILE|none [--cabinet NAME] (game, netplay),
+    //                    --score-stress PROCS [--games N] [--scores FILE]
+    // Differential test: --diff-test SESSIONS [--seed S] [--max-ticks M],
+    //                    --diff-inputs FILE (repeatable), --record-inputs FILE (game)
+    TRACE_THREAD("main");
+    int batchGames = 0;
+    int threads = 0;
+    unsigned int batchSeed = 1;
+    int maxTicks = 37500; // ten minutes of simulated play
+    int benchShots = 0;
+    const char* serverPath = nullptr;
+    const char* clientPath = nullptr;
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    int sessionCount = 64;
+    int clientCount = 1;
+    int seconds = 0;
+    bool bots = false;
+    bool headless = false;
+    int peer = -1;
+    int port = 7000;
+    int remotePort = 7001;
+    int latencyMs = 0;
+    int jitterMs = 0;
+    int lossPct = 0;
+    bool trace = false;
+    bool allocReport = false;
+    bool printLevels = false;
+    bool inputReport = false;
+    const char* levelsPath = nullptr;
+    const char* audioPath = nullptr;
+    const char* scoresPath = "scores.dat";
+    const char* cabinet = nullptr;
+    int scoreStress = 0;
+    int stressGames = 2000;
+    int audioBench = 0;
+    int diffSessions = 0;
+    std::vector<const char*> diffLogs;
+    const char* inputLogPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bots")) bots = true;
+        else if (!strcmp(argv[i], "--headless")) headless = true;
+        else if (!strcmp(argv[i], "--alloc-report")) allocReport = true;
+        else if (!strcmp(argv[i], "--print-levels")) printLevels = true;
+        else if (!strcmp(argv[i], "--input-report")) inputReport = true;
+        else if (!strcmp(argv[i], "--dirty-rects")) dirtyRects = true;
+        else if (i + 1 >= argc) break;
+        else if (!strcmp(argv[i], "--batch")) batchGames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads")) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed")) batchSeed = unsigned(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(argv[i], "--max-ticks")) maxTicks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bullet-bench")) benchShots = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--server")) serverPath = argv[++i];
+        else if (!strcmp(argv[i], "--client")) clientPath = argv[++i];
+        else if (!strcmp(argv[i], "--record")) recordPath = argv[++i];
+        else if (!strcmp(argv[i], "--replay")) replayPath = argv[++i];
+        else if (!strcmp(argv[i], "--sessions")) sessionCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--clients")) clientCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seconds")) seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--peer")) peer = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--port")) port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--remote-port")) remotePort = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--latency")) latencyMs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--jitter")) jitterMs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--loss")) lossPct = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--levels")) levelsPath = argv[++i];
+        else if (!strcmp(argv[i], "--audio")) audioPath = argv[++i];
+        else if (!strcmp(argv[i], "--scores")) scoresPath = argv[++i];
+        else if (!strcmp(argv[i], "--cabinet")) cabinet = argv[++i];
+        else if (!strcmp(argv[i], "--score-stress")) scoreStress = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--games")) stressGames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--fire-rate")) {
+            int rate = atoi(argv[++i]);
+            input.fireTicks = rate > 0 ? std::max(1, int(60.0f / rate + 0.5f)) : 0;
+        }
+        else if (!strcmp(argv[i], "--audio-bench")) audioBench = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--diff-test")) diffSessions = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--diff-inputs")) diffLogs.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--record-inputs")) inputLogPath = argv[++i];
+        else if (!strcmp(argv[i], "--alloc-guard")) allocGuardAfter = unsigned(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--trace")) {
+            tracePath = argv[++i];
+            trace = true;
+        }
+    }
+    if (trace) {
+#ifdef SHOOTER_TRACE
+        atexit(flushTrace);
+#else
+        fprintf(stderr, "--trace ignored: rebuild with -DSHOOTER_TRACE\n");
+#endif
+    }
+    if (allocReport) atexit(printAllocReport);
+    if (inputReport) atexit(printInputReport);
+    if (printLevels) {
+        printLevelRows();
+        return 0;
+    }
+    if (levelsPath && !loadLevelFile(levelsPath)) {
+        return 1;
+    }
+    if (batchGames > 0) {
+        return runBatch(batchGames, threads, batchSeed, maxTicks);
+    }
+    if (benchShots > 0) {
+        return runBulletBench(benchShots, maxTicks, batchSeed);
+    }
+    if (diffSessions > 0 || !diffLogs.empty()) {
+        return runDiffTest(diffSessions, batchSeed, maxTicks, diffLogs);
+    }
+    if (audioPath && recordPath && !strcmp(audioPath, "-") && !strcmp(recordPath, "-")) {
+        fprintf(stderr, "--audio - and --record - can't share stdout\n");
+        return 1;
+    }
+    if (audioPath || audioBench > 0) {
+        audio = openAudio(audioPath ? audioPath : "null");
+        if (!audio) return 1;
+        if (audioBench > 0) return runAudioBench(audioBench, batchSeed);
+        atexit(closeAudioAtExit);
+    }
+#ifndef _WIN32
+    if (scoreStress > 0) {
+        return runScoreStress(strcmp(scoresPath, "scores.dat") ? scoresPath : "scores-stress.dat",
+            scoreStress, stressGames);
+    }
+    if (serverPath) {
+        return runServer(serverPath, sessionCount, threads, bots, seconds);
+    }
+    if (clientPath) {
+        return runClientStub(clientPath, clientCount, seconds > 0 ? seconds : 5);
+    }
+    if (peer == 0 || peer == 1) {
+        std::srand(unsigned(std::time(nullptr)) + peer);   // jitter/loss only
+        setupCoop(world, batchSeed);
+        netSession = new RollbackSession(world, peer);
+        netSession->latencyMs = latencyMs;
+        netSession->jitterMs = jitterMs;
+        netSession->lossPct = lossPct;
+        if (!openNetplay(*netSession, port, remotePort)) return 1;
+        if (headless) return runNetplayHeadless(*netSession, seconds > 0 ? seconds : 10);
+    }
+#endif
+    if (replayPath) {
+        replay = openStreamReader(replayPath);
+        if (!replay) return 1;
+    }
+    if (recordPath) {
+        recorder = openStreamWriter(recordPath);
+        if (!recorder) return 1;
+        atexit(closeRecording);
+    }
+    unsigned int gameSeed = unsigned(std::time(nullptr));
+    if (inputLogPath && (netSession || replay)) {
+        fprintf(stderr, "--record-inputs ignored: it records local games only\n");
+    }
+    else if (inputLogPath) {
+        inputLog = openInputLog(inputLogPath, gameSeed);
+        if (!inputLog) return 1;
+        atexit(closeInputLog);
+    }
+#ifndef _WIN32
+    if (!replay && strcmp(scoresPath, "none")) {
+        char host[SCORE_NAME] = "local";
+        if (!cabinet && gethostname(host, sizeof(host)) == 0) host[SCORE_NAME - 1] = 0;
+        scores = openScoreStore(scoresPath, cabinet ? cabinet : host);   // plays on without one
+    }
+#endif
+
+    // Initialize GLUT
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
+    glutInitWindowSize(windowWidth, windowHeight);
+    glutInitWindowPosition(100, 100);
+    glutCreateWindow("Space Shooter");
+
+    // Set up 2D projection
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    // Enable blending for transparency
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    initSprites();
+    if (dirtyRects && !initCanvas()) {
+        fprintf(stderr, "--dirty-rects needs framebuffer objects; redrawing every frame\n");
+        dirtyRects = false;
+    }
+
+    // Initialize random seed
+    std::srand(std::time(nullptr));
+    if (!netSession) {
+        world = World(gameSeed);
+        reserveWorld(world);
+    }
+
+    // Create starfield
+    initStars();
+
+    // Register callbacks
+    glutDisplayFunc(display);
+    if (replay) {
+        // Viewer: the stream drives the world instead of the simulation
+        glutTimerFunc(16, replayUpdate, 0);
+        glutKeyboardFunc(replayKeyboard);
+        addMessage(world, "Replay: SPACE to pause, ESC to quit");
+        glutMainLoop();
+        return 0;
+    }
+    static ScriptDirector scripts;
+    if (!netSession) attachDirector(world, scripts);
+    glutTimerFunc(16, update, 0);
+    glutKeyboardFunc(keyboard);
+    glutKeyboardUpFunc(keyboardUp);
+    glutIgnoreKeyRepeat(1);   // held fire auto-fires at --fire-rate instead
+    glutSpecialFunc(specialKey);
+    glutSpecialUpFunc(specialKeyUp);
 
     // Initial game message
-    addMessage("Use WASD to move, SPACE to shoot");
-    addMessage("R for rockets, ESC to quit");
+    addMessage(world, "Use WASD to move, SPACE to shoot");
+    addMessage(world, "R for rockets, ESC to quit");
 
     // Start main loop
+    discardAllocFrame();   // setup isn't a frame
     glutMainLoop();
     return 0;
 }
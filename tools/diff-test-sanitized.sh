@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds the game with AddressSanitizer and UndefinedBehaviorSanitizer and
+# runs the differential test with it. The first error aborts the run.
+# Extra arguments go to --diff-test, e.g.: tools/diff-test-sanitized.sh --seed 7
+set -e
+cd "$(dirname "$0")/.."
+CXX=${CXX:-g++}
+SESSIONS=${SESSIONS:-50}
+TICKS=${TICKS:-37500}   # the harness default: ten minutes of play
+
+$CXX -std=c++20 -O1 -g -fsanitize=address,undefined,float-cast-overflow \
+    -fno-sanitize-recover=all -fno-omit-frame-pointer \
+    -o space_shooter_san Game.cpp -lGL -lGLU -lglut -lm -pthread
+./space_shooter_san --diff-test "$SESSIONS" --max-ticks "$TICKS" "$@"